@@ -1,7 +1,7 @@
 
 /*
  * Provides definitions for application.h methods, etc.
- * We have a static member (tt_cache) in this translation unit,
+ * We have a static member (tt_caches) in this translation unit,
  * as if we put it in the class we'd need to include a bunch of
  * headers in application.h due to unordered_map template nature.
  */
@@ -10,20 +10,50 @@
 #include "application.h"
 #include "datetime.h"
 #include "datetime_dmy.h"
+#include "fetch_scheduler.h"
 #include "net_client.h"
 #include "prefs.h"
 #include "tt_day.h"
+#include "tt_diff.h"
 #include "tt_period.h"
 
-// We only need the cache for this translation unit.
-static std::unordered_map<unsigned, tt_day> tt_cache;
+// We only need the cache for this translation unit. There's one
+// per cache directory, so accounts being synced don't share days,
+// and it goes when that directory's application does.
+// The fetch scheduler's workers touch it too, hence the mutex.
+static std::unordered_map<std::string, std::unordered_map<unsigned, tt_day>> tt_caches;
+static std::mutex tt_cache_mtx;
+
+// Format the retrieval time line of a cache file, as YYYY-MM-DD HH:MM in UTC.
+// This is always the same length, so it can be rewritten in place.
+static bool cache_fmt_retrieved(const datetime& rt, char* buf)
+{
+	std::tm d_rt;
+	gmtime_r(&rt.time_utc, &d_rt);
+	return sprintf(buf, COH_CACHE_RETRV_DATE_FORMAT "\n",
+		d_rt.tm_year + 1900,
+		d_rt.tm_mon + 1,
+		d_rt.tm_mday,
+		d_rt.tm_hour,
+		d_rt.tm_min) >= 0;
+}
+
+// Check whether two days have the same periods and events.
+static bool tt_day_same_content(const tt_day& a, const tt_day& b)
+{
+	return a.periods == b.periods && a.events == b.events;
+}
 
 // Constructor.
 application::application(
-	void(*cb_dset)(const datetime_dmy&))
+	void(*cb_dset)(const datetime_dmy&),
+	void(*cb_fetched)(const fetch_result&),
+	const std::string& cdir)
+	: client(nullptr), sched(nullptr), cache_dir(cdir)
 {
 	LOG_INFO("Initialising application...");
 	on_set_date = cb_dset;
+	on_fetched = cb_fetched;
 
 	// Initialise the cache.
 	cache_init();
@@ -33,13 +63,20 @@ application::application(
 application::~application()
 {
 	LOG_INFO("Deinitialising application.");
+
+	// Stop the background workers before the client goes away.
+	if (sched) { delete sched; }
+
+	// Drop our days from memory. They're still on disk.
+	std::lock_guard<std::mutex> lk(tt_cache_mtx);
+	tt_caches.erase(cache_dir);
 }
 
 // Look for the preferences file.
-bool application::prefs_check()
+bool application::prefs_check(const std::string& path)
 {
 	// Check if preferences file exists.
-	std::ifstream f(COH_PREFS_FILE_PATH);
+	std::ifstream f(path);
 	if (!f.good())
 	{
 		// Doesn't exist. We prompt user.
@@ -135,11 +172,13 @@ bool application::prefs_check()
 			{ preferences.membname = rhs; continue; }
 
 			// Assign to the corresponding string in prefs file.
-			S_COMPARE(COH_PREF_NAME_HOSTNAME, hostname);
-			S_COMPARE(COH_PREF_NAME_PLOGIN,   path_login);
-			S_COMPARE(COH_PREF_NAME_PAUTH,    path_auth);
-			S_COMPARE(COH_PREF_NAME_PTT,      path_tt);
-			S_COMPARE(COH_PREF_NAME_PLOGOFF,  path_logoff);
+			S_COMPARE(COH_PREF_NAME_HOSTNAME,   hostname);
+			S_COMPARE(COH_PREF_NAME_PLOGIN,     path_login);
+			S_COMPARE(COH_PREF_NAME_PAUTH,      path_auth);
+			S_COMPARE(COH_PREF_NAME_PTT,        path_tt);
+			S_COMPARE(COH_PREF_NAME_PLOGOFF,    path_logoff);
+			S_COMPARE(COH_PREF_NAME_WHOOK,      watch_hook);
+			S_COMPARE(COH_PREF_NAME_CREDHELPER, cred_helper);
 
 			LOG_WARN("Prefs, line %d: Unrecognised preference: '%s'", cur_line, lhs.c_str());
 
@@ -197,10 +236,15 @@ bool application::get_tt_for_day_if_cached(tt_day& outp, const datetime_dmy& d)
 {
 	// Try read from memory cache first.
 	int id = datetime_dmy_id(d).id;
-	if (tt_cache.find(id) != tt_cache.end())
 	{
-		outp = tt_cache[id];
-		return true;
+		std::lock_guard<std::mutex> lk(tt_cache_mtx);
+		const std::unordered_map<unsigned, tt_day>& tt_cache = tt_caches[cache_dir];
+		auto it = tt_cache.find(id);
+		if (it != tt_cache.end())
+		{
+			outp = it->second;
+			return true;
+		}
 	}
 
 	// Try read the filesystem cache to see if we have it on disk.
@@ -213,14 +257,84 @@ bool application::get_tt_for_day_if_cached(tt_day& outp, const datetime_dmy& d)
 	return false;
 }
 
-// Get the timetable for a day.
-bool application::get_tt_for_day_update(tt_day& outp, const datetime_dmy& d)
+// Check the cached day against our freshness policy.
+// - Past days never go stale.
+// - Today goes stale after COH_CACHE_TTL_TODAY.
+// - Future days go stale after COH_CACHE_TTL_FUTURE.
+bool application::is_stale(const tt_day& t, const datetime_dmy& d) const
 {
-	// Get ID of date.
+	std::time_t n = std::time(0);
+	std::tm now;
+	localtime_r(&n, &now);
+	int id_today = datetime_dmy_id(datetime_dmy(
+		now.tm_mday, now.tm_mon + 1, now.tm_year + 1900, now.tm_wday)).id;
 	int id = datetime_dmy_id(d).id;
 
+	// Past days won't change any more.
+	if (id < id_today)
+	{
+		return false;
+	}
+
+	double age = std::difftime(n, t.retrieved.time_utc);
+	if (id == id_today)
+	{
+		return age >= COH_CACHE_TTL_TODAY;
+	}
+	return age >= COH_CACHE_TTL_FUTURE;
+}
+
+// Queue a fetch.
+void application::fetch(const datetime_dmy& d, fetch_class cls, void(*cb_prog)(uint64_t, uint64_t))
+{
+	if (!client)
+	{
+		return;
+	}
+
+	// Start the workers the first time we need them. Headless modes
+	// that fetch directly never do.
+	if (!sched)
+	{
+		sched = new fetch_scheduler(this, COH_SCHED_WORKERS, on_fetched);
+	}
+	sched->submit(d, cls, cb_prog);
+}
+
+// Cancel a class of fetches.
+void application::fetch_cancel(fetch_class cls)
+{
+	if (sched)
+	{
+		sched->cancel(cls);
+	}
+}
+
+// Get the numbers of a class.
+fetch_metrics application::fetch_metrics_get(fetch_class cls) const
+{
+	if (!sched)
+	{
+		return fetch_metrics();
+	}
+	return sched->metrics(cls);
+}
+
+// Refresh the day in the background.
+void application::revalidate(const datetime_dmy& d)
+{
+	fetch(d, FETCH_REVALIDATE);
+}
+
+// Get the timetable for a day.
+bool application::get_tt_for_day_update(tt_day& outp, const datetime_dmy& d, bool* changed,
+	std::vector<tt_change>* changes_out, const request_ctx& ctx)
+{
 	// Retrieve the data using client, add to cache, and return it.
+	// The fingerprint lets the client skip parsing an identical response.
 	tt_day ret;
+	ret.fingerprint = cached_fingerprint(d);
+	bool unchanged = false;
 
 #ifdef COH_USE_SAMPLE_DATA
 	// Use example data instead of actually retrieving it.
@@ -235,13 +349,49 @@ bool application::get_tt_for_day_update(tt_day& outp, const datetime_dmy& d)
 	ret.events .push_back(tt_period("Sample event with an extremely long amount of text to test if the text will actually wrap around the way I'd like it to?",    {  6,  20 }, { 12, 50 }, period_state::EVENT, preferences));
 #else
 	// Retrieve from the site.
-	if (!client->retrieve_data(ret.periods, ret.events, d, preferences))
+	if (!client->retrieve_data(ret.periods, ret.events, d, preferences, ret.fingerprint, unchanged, ctx))
 	{
 		LOG_ERROR("Was unable to retrieve data.");
 		return false;
 	}
 #endif
 
+	return day_retrieved(outp, d, ret, unchanged, changed, changes_out);
+}
+
+// Fingerprint of what we have cached for a day, if anything.
+std::string application::cached_fingerprint(const datetime_dmy& d) const
+{
+	tt_day prev;
+	return get_tt_for_day_if_cached(prev, d) ? prev.fingerprint : "";
+}
+
+// Take in a day we just retrieved. Compares it to what we had,
+// logs the changes, and caches it.
+bool application::day_retrieved(tt_day& outp, const datetime_dmy& d, tt_day& ret, bool unchanged,
+	bool* changed, std::vector<tt_change>* changes_out)
+{
+	// Get ID of date.
+	int id = datetime_dmy_id(d).id;
+
+	// Whatever we had before.
+	tt_day prev;
+	bool had_prev = get_tt_for_day_if_cached(prev, d);
+
+	// Same response as we have cached. Only the retrieval time moves.
+	if (unchanged)
+	{
+		prev.retrieved = datetime();
+		{
+			std::lock_guard<std::mutex> lk(tt_cache_mtx);
+			tt_caches[cache_dir][id].retrieved = prev.retrieved;
+		}
+		cache_touch(prev, id);
+		if (changed) { *changed = false; }
+		outp = prev;
+		return true;
+	}
+
 	// Sort vectors by begin time.
 	static const auto l_vec_sort = [](const tt_period& l, const tt_period& r)
 	{
@@ -250,7 +400,30 @@ bool application::get_tt_for_day_update(tt_day& outp, const datetime_dmy& d)
 	std::sort(ret.periods.begin(), ret.periods.end(), l_vec_sort);
 	std::sort(ret.events .begin(), ret.events .end(), l_vec_sort);
 
-	tt_cache[id] = ret;
+	// Compare against what we had before, if anything.
+	// (The fingerprint differs, but old cache files don't have one.)
+	bool is_changed = !had_prev || !tt_day_same_content(prev, ret);
+	if (changed)
+	{
+		*changed = is_changed;
+	}
+
+	// Record what changed. Nothing to compare to the first time round.
+	if (had_prev && is_changed)
+	{
+		std::vector<tt_change> changes;
+		tt_diff::diff(prev, ret, id, changes);
+		tt_diff::log_append(changes, cache_dir + COH_CHANGE_LOG_NAME);
+		if (changes_out)
+		{
+			changes_out->insert(changes_out->end(), changes.begin(), changes.end());
+		}
+	}
+
+	{
+		std::lock_guard<std::mutex> lk(tt_cache_mtx);
+		tt_caches[cache_dir][id] = ret;
+	}
 	cache_write(ret, id);
 	outp = ret;
 	return true;
@@ -268,28 +441,55 @@ net_client* const application::client_get(void) const
 	return client;
 }
 
-// Add to the current date
+// Get today's date as datetime_dmy
+datetime_dmy application::date_today(void)
+{
+	// Get current local time.
+	std::time_t n = std::time(0);
+	std::tm now;
+	localtime_r(&n, &now);
+
+	// Return object with the correct offsets.
+	return datetime_dmy(
+		now.tm_mday,
+		now.tm_mon + 1,
+		now.tm_year + 1900,
+		now.tm_wday
+	);
+}
+
+// Get the date a number of days after d.
 // https://stackoverflow.com/questions/2344330/algorithm-to-add-or-subtract-days-from-a-date
-void application::cur_date_add(int days)
+datetime_dmy application::date_add(const datetime_dmy& d, int days)
 {
 	// We need to convert the datetime_dmy back to a std::tm.
 	std::time_t raw;
 	time(&raw);
-	std::tm t  = *localtime(&raw);
-	t.tm_year = cur_date.year - 1900;
-	t.tm_mon  = cur_date.month - 1;
-	t.tm_mday = cur_date.day;
+	std::tm t;
+	localtime_r(&raw, &t);
+	t.tm_year = d.year - 1900;
+	t.tm_mon  = d.month - 1;
+	t.tm_mday = d.day;
 
 	// Seconds since start of epoch.
 	static const time_t ONE_DAY = 24 * 60 * 60;
-	time_t d = mktime(&t) + days * ONE_DAY;
+	time_t dt = mktime(&t) + days * ONE_DAY;
+
+	// Move the new data into the result.
+	std::tm datenew;
+	localtime_r(&dt, &datenew);
+	return datetime_dmy(
+		datenew.tm_mday,
+		datenew.tm_mon + 1,
+		datenew.tm_year + 1900,
+		datenew.tm_wday
+	);
+}
 
-	// Move the new data into cur_date.
-	std::tm datenew = *localtime(&d);
-	cur_date.year   = datenew.tm_year + 1900;
-	cur_date.month  = datenew.tm_mon + 1;
-	cur_date.day    = datenew.tm_mday;
-	cur_date.dow    = datenew.tm_wday;
+// Add to the current date
+void application::cur_date_add(int days)
+{
+	cur_date = date_add(cur_date, days);
 
 	// Date changed.
 	on_set_date(cur_date);
@@ -299,9 +499,9 @@ void application::cur_date_add(int days)
 void application::cache_init(void)
 {
 	// Check if we already have a cache directory.
-	std::ifstream cache_dir(COH_CACHE_DIR);
+	std::ifstream cache_dir_f(cache_dir);
 	cache_enabled = true;
-	if (cache_dir.good())
+	if (cache_dir_f.good())
 	{
 		return;
 	}
@@ -309,7 +509,7 @@ void application::cache_init(void)
 	LOG_INFO("No cache directory. Creating...");
 
 	// Create the directory.
-	if (mkdir(COH_CACHE_DIR, 0777) != 0)
+	if (mkdir(cache_dir.c_str(), 0777) != 0)
 	{
 		LOG_WARN("Unable to create cache directory!");
 		cache_enabled = false;
@@ -327,15 +527,14 @@ void application::cache_write(const tt_day& day, int id)
 	}
 
 	// Get the filename.
-	char fname[sizeof(COH_CACHE_DIR) + sizeof("YYYYMMDD")];
-	if (sprintf(fname, COH_CACHE_DIR "%u", id) == -1)
-	{
-		LOG_ERROR("Error while getting filename for cache file in cache_write.");
-		return;
-	}
-
-	// Write to the cache directory.
-	std::ofstream file(fname);
+	std::string fname = cache_fname(id);
+
+	// Write to a temporary file and rename it over the old one,
+	// so a reader on another thread never sees half a file.
+	// (Named per-thread, as the UI and a worker could write the same day.)
+	std::string fname_tmp = std::string(fname) + ".tmp"
+		+ std::to_string(std::hash<std::thread::id>()(std::this_thread::get_id()));
+	std::ofstream file(fname_tmp);
 	if(!file.good())
 	{
 		LOG_ERROR("Couldn't open file stream for cache file.");
@@ -346,29 +545,60 @@ void application::cache_write(const tt_day& day, int id)
 	cache_write_to_file(file, day);
 
 	file.close();
+	if (rename(fname_tmp.c_str(), fname.c_str()) != 0)
+	{
+		LOG_ERROR("Couldn't move cache file into place for ID:%d.", id);
+	}
+}
+
+// Only update the retrieval time of a cached day on disk.
+// We overwrite the first line in place rather than rewriting the file.
+void application::cache_touch(const tt_day& day, int id)
+{
+	if (!cache_enabled)
+	{
+		return;
+	}
+
+	std::string fname = cache_fname(id);
+	char d_rt_str[sizeof "YYYY-MM-DD HH:MM\n"];
+	if (!cache_fmt_retrieved(day.retrieved, d_rt_str))
+	{
+		LOG_ERROR("Error while formatting cache info in cache_touch.");
+		return;
+	}
+
+	std::fstream file(fname, std::ios::in | std::ios::out);
+	if (!file.good())
+	{
+		// Not on disk (yet), so write the whole thing.
+		cache_write(day, id);
+		return;
+	}
+	file.seekp(0);
+	file.write(d_rt_str, strlen(d_rt_str));
+}
+
+// Get the filename of a cached day.
+std::string application::cache_fname(int id) const
+{
+	return cache_dir + std::to_string((unsigned)id);
 }
 
 // Actually write the data to the cache.
 void application::cache_write_to_file(std::ofstream& f, const tt_day& d) const
 {
 	// First write the retrieval time as YYYY-MM-DD HH:MM in UTC.
-	std::tm d_rt = *gmtime(&d.retrieved.time_utc);
 	char d_rt_str[sizeof "YYYY-MM-DD HH:MM\n"];
-	if (sprintf(d_rt_str, COH_CACHE_RETRV_DATE_FORMAT "\n",
-		d_rt.tm_year + 1900,
-		d_rt.tm_mon + 1,
-		d_rt.tm_mday,
-		d_rt.tm_hour,
-		d_rt.tm_min) < 0
-	)
+	if (!cache_fmt_retrieved(d.retrieved, d_rt_str))
 	{
 		LOG_ERROR("Didn't write all retrieval datetime info to cache file.");
 		return;
 	}
 	f << d_rt_str;
 
-	// Write number of periods and events.
-	f << d.periods.size() << "," << d.events.size() << std::endl;
+	// Write number of periods and events, and the response fingerprint.
+	f << d.periods.size() << "," << d.events.size() << "," << d.fingerprint << std::endl;
 
 	// This lambda is used twice, for writing periods and events.
 	auto l_write_tt_periods = [&f](const std::vector<tt_period>& data)
@@ -409,13 +639,8 @@ void application::cache_write_to_file(std::ofstream& f, const tt_day& d) const
 // Try read from the cache on disk. If we get it, we will also add it to the memory cache.
 bool application::cache_read(tt_day& outp, int id) const
 {
-	// Get filename. TODO: Move to a method.
-	char fname[sizeof(COH_CACHE_DIR) + sizeof("YYYYMMDD")];
-	if (sprintf(fname, COH_CACHE_DIR "%u", id) == -1)
-	{
-		LOG_ERROR("Error while getting filename for cache file in cache_read.");
-		return false;
-	}
+	// Get filename.
+	std::string fname = cache_fname(id);
 
 	// Check if file exists.
 	std::ifstream f(fname);
@@ -444,10 +669,15 @@ bool application::cache_read(tt_day& outp, int id) const
 	or_date.tm_hour = or_hr; or_date.tm_min  = or_mn;
 	o.retrieved = datetime(timegm(&or_date));
 
-	// Second line is number of periods/events.
+	// Second line is number of periods/events, then the fingerprint.
+	// (Older cache files don't have the fingerprint.)
 	S_LINE_GET;
 	unsigned size_p, size_e;
-	sscanf(line.c_str(), "%u,%u", &size_p, &size_e);
+	char fprint[65];
+	if (sscanf(line.c_str(), "%u,%u,%64s", &size_p, &size_e, fprint) == 3)
+	{
+		o.fingerprint = fprint;
+	}
 
 	// Use this lambda for both vectors.
 	auto l_get_tt_periods = [&](std::vector<tt_period>& ovec, unsigned size)
@@ -513,7 +743,8 @@ bool application::cache_read(tt_day& outp, int id) const
 	outp = o;
 
 	// Put into our memory cache.
-	tt_cache[id] = o;
+	std::lock_guard<std::mutex> lk(tt_cache_mtx);
+	tt_caches[cache_dir][id] = o;
 
 	return true;
 }
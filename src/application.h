@@ -7,16 +7,24 @@
 
 #include "prefs.h"
 #include "datetime_dmy.h"
+#include "request_ctx.h"
 
 struct datetime_dmy;
 struct net_client;
+struct tt_change;
+enum fetch_class : char;
+struct fetch_metrics;
+struct fetch_result;
 struct tt_day;
+class fetch_scheduler;
 
 class application
 {
 public:
 	application(
-		void(*cb_dset)(const datetime_dmy&)
+		void(*cb_dset)(const datetime_dmy&),
+		void(*cb_fetched)(const fetch_result&),
+		const std::string& cdir=COH_CACHE_DIR
 	);
 	~application();
 
@@ -24,7 +32,7 @@ public:
 	inline prefs get_prefs() const { return preferences; }
 
 	// Check for preferences file to load from.
-	bool prefs_check();
+	bool prefs_check(const std::string& path=COH_PREFS_FILE_PATH);
 
 	// Create the preferences file using info.
 	void prefs_setup(const prefs& p);
@@ -36,12 +44,49 @@ public:
 	net_client* const client_get(void) const;
 
 	// Retrieve timetable for the day. Doesn't read from cache.
-	bool get_tt_for_day_update(tt_day& outp, const datetime_dmy& d);
+	// If changed is passed, it is set to whether the content differs
+	// from what we had cached. If changes is passed, what changed
+	// is appended to it. The context bounds and can cancel the request.
+	bool get_tt_for_day_update(tt_day& outp, const datetime_dmy& d, bool* changed=nullptr,
+		std::vector<tt_change>* changes=nullptr,
+		const request_ctx& ctx=request_ctx(COH_NET_DEADLINE_RETRIEVE_MS));
+
+	// The two halves of get_tt_for_day_update, for when the request
+	// is sent some other way. (See session_task.h) The first gets the
+	// fingerprint to retrieve with; the second takes in what came back
+	// and caches it, as above.
+	std::string cached_fingerprint(const datetime_dmy& d) const;
+	bool day_retrieved(tt_day& outp, const datetime_dmy& d, tt_day& ret, bool unchanged,
+		bool* changed=nullptr, std::vector<tt_change>* changes=nullptr);
 
 	// Gets the timetable data for day *from cache* if we have it.
 	// If not, we return false.
 	bool get_tt_for_day_if_cached(tt_day& outp, const datetime_dmy& d) const;
 
+	// Whether a cached day is past its freshness TTL.
+	bool is_stale(const tt_day& t, const datetime_dmy& d) const;
+
+	// Fetch the day in the background with the given priority
+	// (see fetch_scheduler.h). The fetched callback is called from
+	// a worker thread when it's done.
+	void fetch(const datetime_dmy& d, fetch_class cls, void(*cb_prog)(uint64_t, uint64_t)=nullptr);
+
+	// Cancel background fetches of a priority class.
+	void fetch_cancel(fetch_class cls);
+
+	// Queue depth, wait times and failures of a priority class so
+	// far. (All zero if nothing has been fetched in the background.)
+	fetch_metrics fetch_metrics_get(fetch_class cls) const;
+
+	// Refresh a stale day in the background.
+	void revalidate(const datetime_dmy& d);
+
+	// Get today's date.
+	static datetime_dmy date_today(void);
+
+	// Get the date a number of days after d.
+	static datetime_dmy date_add(const datetime_dmy& d, int days);
+
 	// Add to the current date.
 	void cur_date_add(int);
 	inline void cur_date_incr(void) { cur_date_add( 1); }
@@ -67,11 +112,18 @@ private:
 	// The client used to get info.
 	net_client* client;
 
+	// Runs fetches in the background.
+	fetch_scheduler* sched;
+
 	// The current date we are viewing.
 	datetime_dmy cur_date;
 
 	// Callbacks.
 	void(*on_set_date)(const datetime_dmy&);
+	void(*on_fetched)(const fetch_result&);
+
+	// Where days are cached. (With a trailing slash.)
+	std::string cache_dir;
 
 	// Whether we can use filesystem caching or not.
 	bool cache_enabled;
@@ -83,6 +135,12 @@ private:
 	// Writes the passed day to cache on disk.
 	void cache_write(const tt_day&, int);
 
+	// Only update the retrieval time of a day on disk.
+	void cache_touch(const tt_day&, int);
+
+	// Get the cache filename of a day.
+	std::string cache_fname(int) const;
+
 	// Actually write the data to file.
 	void cache_write_to_file(std::ofstream&, const tt_day&) const;
 
@@ -1,48 +1,139 @@
-
 #include "pch.h"
 #include "cookie.h"
 #include "datetime.h"
 
-// Construct cookie from string.
-cookie::cookie(const std::string& s)
+// Trim spaces and tabs from both ends.
+static std::string_view trim(std::string_view s)
 {
-	LOG_DBUG("Constructing cookie: %s", s.c_str());
+	while (!s.empty() && (s.front() == ' ' || s.front() == '\t')) { s.remove_prefix(1); }
+	while (!s.empty() && (s.back()  == ' ' || s.back()  == '\t')) { s.remove_suffix(1); }
+	return s;
+}
 
-	expiry_init = false;
+// Compare an attribute name, ignoring case.
+static bool attr_is(std::string_view s, const char* name)
+{
+	return s.length() == strlen(name) && strncasecmp(s.data(), name, s.length()) == 0;
+}
 
-	// Get the identifier.
-	char* buffer = (char*)alloca(s.find(";") + 1);
-	if (!buffer)
+// Parse an Expires date. Both 'Wed, 21 Oct 2026 07:28:00 GMT' and the
+// older dashed form with a two digit year turn up.
+static bool expires_parse(std::string_view s, std::time_t& out)
+{
+	// strptime wants it terminated.
+	char buf[64];
+	if (s.length() >= sizeof(buf))
 	{
-		LOG_ERROR("Out of memory!");
-		return;
+		return false;
 	}
-	sscanf(s.c_str(), "%s; %*s", buffer);
-
-	// Move into our buffer.
-	id = std::string(buffer);
+	memcpy(buf, s.data(), s.length());
+	buf[s.length()] = '\0';
 
-	// Try to get the expiry date if it exists.
-	size_t p = s.find("expires=");
-	if (p != std::string::npos)
+	static const char* const fmts[] = {
+		"%a, %d %b %Y %H:%M:%S",
+		"%a, %d-%b-%Y %H:%M:%S"
+	};
+	for (const char* fmt : fmts)
 	{
-		// Parse the expiry date.
-		char emon_str[4];
-		unsigned eday, eyr;
-		sscanf(s.c_str() + p, "expires=%*03s, %02u-%03s-%u %*s",
-			&eday, emon_str, &eyr);
+		std::tm t = {};
+		if (!strptime(buf, fmt, &t))
+		{
+			continue;
+		}
 
 		// If the year was 2 digit, add the thousands.
-		if (eyr < 2000)
+		if (t.tm_year < 0)
 		{
-			eyr += 2000;
+			t.tm_year += 2000;
 		}
 
-		// Convert month to a number.
-		unsigned emon = util::month_lookup_from_str(emon_str);
+		// Always given in GMT.
+		out = timegm(&t);
+		return true;
+	}
+	return false;
+}
+
+// Parse a Set-Cookie header.
+bool cookie_view::parse(std::string_view s)
+{
+	expiry = 0;
+	expiry_has = false;
+	path = domain = std::string_view();
+
+	// The name=value comes first.
+	size_t semi = s.find(';');
+	std::string_view pair = trim(s.substr(0, semi));
+	size_t eq = pair.find('=');
+	if (eq == std::string_view::npos || eq == 0)
+	{
+		return false;
+	}
+	name  = trim(pair.substr(0, eq));
+	value = trim(pair.substr(eq + 1));
+
+	// Then the attributes.
+	bool max_age = false;
+	while (semi != std::string_view::npos)
+	{
+		s.remove_prefix(semi + 1);
+		semi = s.find(';');
+		std::string_view attr = trim(s.substr(0, semi));
+		eq = attr.find('=');
+		std::string_view key = trim(attr.substr(0, eq));
+		std::string_view val = eq == std::string_view::npos ? std::string_view() : trim(attr.substr(eq + 1));
 
-		// Set expiry date.
-		expiry = datetime(eday, emon, eyr);
-		expiry_init = true;
+		// Max-Age wins over Expires, as browsers do. It counts from now.
+		if (attr_is(key, "max-age"))
+		{
+			long secs;
+			if (std::from_chars(val.data(), val.data() + val.length(), secs).ec == std::errc())
+			{
+				expiry = std::time(0) + secs;
+				expiry_has = max_age = true;
+			}
+		}
+		else if (attr_is(key, "expires"))
+		{
+			std::time_t t;
+			if (max_age)
+			{
+				continue;
+			}
+			if (expires_parse(val, t))
+			{
+				expiry = t;
+				expiry_has = true;
+			}
+			else
+			{
+				LOG_WARN("Couldn't parse cookie expiry: %.*s", (int)val.length(), val.data());
+			}
+		}
+		else if (attr_is(key, "path"))
+		{
+			path = val;
+		}
+		else if (attr_is(key, "domain"))
+		{
+			// A leading dot means nothing these days.
+			if (!val.empty() && val.front() == '.')
+			{
+				val.remove_prefix(1);
+			}
+			domain = val;
+		}
 	}
+	return true;
+}
+
+// Take on a parsed header.
+void cookie::assign(const cookie_view& v)
+{
+	name.assign(v.name);
+	value.assign(v.value);
+	path.assign(v.path);
+	domain.assign(v.domain);
+	expiry = datetime(v.expiry);
+	expiry_init = v.expiry_has;
 }
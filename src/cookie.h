@@ -1,24 +1,41 @@
-
 #ifndef COH_COOKIE_H
 #define COH_COOKIE_H
 
 /*
  * cookie.h
- * - Represents a single cookie object.
+ * - Parses Set-Cookie headers, and represents a single cookie.
+ * - cookie_view is the parsed header. It only points into the
+ *   header, so parsing copies and allocates nothing. A cookie
+ *   holds the parts the jar keeps.
  */
 
 #include "datetime.h"
 
+// A Set-Cookie header, split up. Points into the header, which must
+// outlive it.
+struct cookie_view
+{
+	std::string_view name;
+	std::string_view value;
+	std::string_view path;
+	std::string_view domain;
+
+	// When it expires, from Max-Age or else Expires.
+	std::time_t expiry;
+	bool expiry_has;
+
+	// Parse a header. Returns false if it has no name=value.
+	bool parse(std::string_view);
+};
+
 struct cookie
 {
-	// Construct cookie from string.
-	cookie(const std::string& s);
+	cookie()
+		: expiry(0), expiry_init(false)
+	{}
 
-	// Get the identifier
-	inline std::string get_id() const
-	{
-		return id;
-	}
+	// Take on a parsed header, re-using our strings' storage.
+	void assign(const cookie_view&);
 
 	// Does this cookie expire?
 	inline bool expiry_has(void) const
@@ -26,14 +43,18 @@ struct cookie
 		return expiry_init;
 	}
 
-	// Get the expiry date.
+	// Get the expiry time.
 	inline datetime expiry_get(void) const
 	{
 		return expiry;
 	}
 
+	std::string name;
+	std::string value;
+	std::string path;
+	std::string domain;
+
 private:
-	std::string id;
 	datetime expiry;
 	bool expiry_init;
 };
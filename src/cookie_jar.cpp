@@ -10,112 +10,228 @@
 #include "cookie_jar.h"
 
 // Constructor.
-cookie_jar::cookie_jar()
+cookie_jar::cookie_jar(const std::string& p, bool load)
+	: path(p), expiry_earliest_init(false), loaded_from_disk(false),
+	dirty(false), saved_at(0)
 {
-	// Initialise to null.
-	expiry_earliest_init = false;
-	loaded_from_disk = false;
+	// Reserve for a handful of cookies.
+	content.reserve(8);
 
 	// Check if we already have a cookie jar on disk.
-	load_cookies_from_disk();
-
-	// If we didn't loaded any cookies, reserve for some objects.
-	if (!loaded_from_disk)
+	if (load)
 	{
-		// Reserve for 7 cookies.
-		content.reserve(5);
+		load_cookies_from_disk();
 	}
 }
 
 // Called upon deletion.
 cookie_jar::~cookie_jar()
 {
-	// Free all the memory used by cookies.
+	// Don't lose what changed since the last write.
+	persist(true);
 	LOG_INFO("Freeing cookie jar...");
-	for (unsigned i = 0; i < content.size(); ++i)
-	{
-		delete content[i];
-	}
 }
 
 // Add a cookie to the cookie jar.
-void cookie_jar::add_cookie(cookie* const c)
+void cookie_jar::add_cookie(std::string_view s)
 {
-	// Ignore if we loaded from disk.
-	if (loaded_from_disk)
+	cookie_view v;
+	if (!v.parse(s))
 	{
-		LOG_WARN("Tried to add a cookie when we are loaded from disk.");
-		delete c;
+		LOG_WARN("Ignoring a cookie with no name.");
 		return;
 	}
+	LOG_DBUG("Got cookie: %.*s", (int)v.name.length(), v.name.data());
 
-	content.emplace_back(c);
+	std::lock_guard<std::mutex> lk(mtx);
+	if (merge(v) && !user_id.empty())
+	{
+		dirty = true;
+	}
+}
 
-	// Check if this cookie has an earlier expiry
-	// date than the current.
-	if (c->expiry_has() && (c->expiry_get() < expiry_earliest || !expiry_earliest_init))
+// Add every cookie a response set.
+void cookie_jar::add_cookies(const httplib::Headers& h)
+{
+	// (Headers compare without case, so this finds any spelling.)
+	auto r = h.equal_range("set-cookie");
+	if (r.first == r.second)
 	{
-		// Copy the earlier time.
-		expiry_earliest_init = true;
-		expiry_earliest = datetime(c->expiry_get());
+		return;
+	}
+
+	std::lock_guard<std::mutex> lk(mtx);
+	bool changed = false;
+	for (; r.first != r.second; ++r.first)
+	{
+		cookie_view v;
+		if (v.parse(r.first->second))
+		{
+			LOG_DBUG("Got cookie: %.*s", (int)v.name.length(), v.name.data());
+			changed |= merge(v);
+		}
+	}
+	if (changed && !user_id.empty())
+	{
+		dirty = true;
 	}
 }
 
-// Get concatenated cookie strings.
-std::string cookie_jar::get_compound_string(void) const
+// Add a parsed cookie.
+bool cookie_jar::merge(const cookie_view& v)
 {
-	// If we are loaded from disk, just use the override string.
-	if (loaded_from_disk)
+	auto it = std::find_if(content.begin(), content.end(),
+		[&](const cookie& c) { return v.name == c.name; });
+
+	// An expired cookie is the site deleting it.
+	if (v.expiry_has && v.expiry <= std::time(0))
 	{
-		return loaded_disk_override;
+		if (it == content.end())
+		{
+			return false;
+		}
+		content.erase(it);
+		expiry_update();
+		compound_update();
+		return true;
 	}
 
-	// Not from disk.
+	// The same cookie again changes nothing.
+	if (it != content.end() && it->value == v.value && it->expiry_has() == v.expiry_has
+		&& (!v.expiry_has || it->expiry_get().time_utc == v.expiry))
+	{
+		return false;
+	}
+
+	// Replace the one with the same name, or add it. The header
+	// only changes if the value does.
+	bool changed = it == content.end() || it->value != v.value;
+	if (it == content.end())
+	{
+		it = content.emplace(content.end());
+	}
+	it->assign(v);
+	expiry_update();
+	if (changed)
+	{
+		compound_update();
+	}
+	return true;
+}
+
+// Find the earliest expiry.
+void cookie_jar::expiry_update(void)
+{
+	expiry_earliest_init = false;
+	for (const cookie& c : content)
+	{
+		if (c.expiry_has() && (!expiry_earliest_init || c.expiry_get() < expiry_earliest))
+		{
+			expiry_earliest_init = true;
+			expiry_earliest = c.expiry_get();
+		}
+	}
+}
 
-	// Just iterate over all of them and add to the string.
-	std::string result;
-	result.reserve(128);
-	for (unsigned i = 0; i < content.size(); ++i)
+// Build the Cookie header.
+void cookie_jar::compound_update(void)
+{
+	compound.clear();
+	for (const cookie& c : content)
 	{
-		result += content[i]->get_id() + " ";
+		if (!compound.empty())
+		{
+			compound += "; ";
+		}
+		compound += c.name;
+		compound += '=';
+		compound += c.value;
 	}
-	return result;
 }
 
 // Validate all the cookies we have, and save into a file.
 void cookie_jar::validate(const char* uid)
 {
-	if (loaded_from_disk)
+	std::lock_guard<std::mutex> lk(mtx);
+	user_id = uid;
+	save();
+}
+
+// Write the jar out if it's changed and it's been long enough.
+void cookie_jar::persist(bool force)
+{
+	std::lock_guard<std::mutex> lk(mtx);
+	if (dirty && !path.empty() && (force || std::time(0) - saved_at >= COH_COOKIE_JAR_SAVE_SECS))
 	{
-		LOG_INFO("Not writing to disk, because we read from it.");
-		return;
+		save();
 	}
+}
 
-	LOG_INFO("Writing validated cookies to file.");
+// Stop writing to disk.
+void cookie_jar::detach(void)
+{
+	std::lock_guard<std::mutex> lk(mtx);
+	path.clear();
+	dirty = false;
+}
 
-	user_id = uid;
+// Start writing to disk.
+void cookie_jar::attach(const std::string& p)
+{
+	std::lock_guard<std::mutex> lk(mtx);
+	path = p;
+	if (!user_id.empty())
+	{
+		save();
+	}
+}
+
+// Write the file.
+void cookie_jar::save(void)
+{
+	if (path.empty())
+	{
+		return;
+	}
+	LOG_INFO("Writing validated cookies to file.");
 
 	// Just create a file in the same directory.
-	// The first line will have the earliest expiry date of all the cookies.
-	// If the expiry date has passed, then we discard it and prompt user to sign in
+	// The first line will have the earliest expiry time of all the cookies,
+	// in seconds since the epoch, or 0 if none of them expire.
+	// If the expiry time has passed, then we discard it and prompt user to sign in
 	// again.
-	std::ofstream file(COH_COOKIE_JAR_PATH);
+	std::ofstream file(path);
 
-	std::tm* e = gmtime(&expiry_earliest.time_utc);
-	file << "expiry=" << (e->tm_mday) << "."
-		<< (e->tm_mon + 1) << "."
-		<< e->tm_year + 1900 << std::endl;
-	file << "uid=" << uid << std::endl;
-	file << get_compound_string();
+	file << "expiry=" << (long long)(expiry_earliest_init ? expiry_earliest.time_utc : 0) << std::endl;
+	file << "uid=" << user_id << std::endl;
+	file << compound << std::endl;
+
+	// Then each cookie that expires, as a Set-Cookie header, so
+	// it keeps its own expiry when it's loaded.
+	for (const cookie& c : content)
+	{
+		if (!c.expiry_has())
+		{
+			continue;
+		}
+		char expires[40];
+		std::tm t;
+		std::time_t e = c.expiry_get().time_utc;
+		gmtime_r(&e, &t);
+		strftime(expires, sizeof(expires), "%a, %d %b %Y %H:%M:%S GMT", &t);
+		file << c.name << "=" << c.value << "; Expires=" << expires << std::endl;
+	}
 
 	file.close();
+	dirty = false;
+	saved_at = std::time(0);
 }
 
 // Try to load a cookie jar from disk.
 void cookie_jar::load_cookies_from_disk()
 {
 	// Check if file exists.
-	std::ifstream f(COH_COOKIE_JAR_PATH);
+	std::ifstream f(path);
 	if (!f.good())
 	{
 		LOG_INFO("No cookie jar on disk. Logging in manually.");
@@ -134,16 +250,22 @@ void cookie_jar::load_cookies_from_disk()
 		return;
 	}
 
-	// Parse expiration date.
+	// Parse expiration time. Older jars only have the date.
 	unsigned ed, em, ey;
-	if (sscanf(ln_expiry.c_str(), "expiry=%u.%u.%u", &ed, &em, &ey) != 3)
+	long long et;
+	if (sscanf(ln_expiry.c_str(), "expiry=%u.%u.%u", &ed, &em, &ey) == 3)
+	{
+		et = datetime(ed, em, ey).time_utc;
+	}
+	else if (sscanf(ln_expiry.c_str(), "expiry=%lld", &et) != 1)
 	{
 		LOG_WARN("Failed to parse cookie jar expiration date on disk. Aborting load...");
 		return;
 	}
 
-	// Check if the expiry date has passed.
-	if (datetime(std::time(0)) >= datetime(ed, em, ey))
+	// Check if the expiry time has passed. Session cookies only
+	// last as long as the site lets them, which a probe finds out.
+	if (et && std::time(0) >= (std::time_t)et)
 	{
 		LOG_INFO("Cookie jar is expired. Will not use.");
 		return;
@@ -151,7 +273,7 @@ void cookie_jar::load_cookies_from_disk()
 
 	// Parse user id.
 	char uid[16];
-	if (sscanf(ln_userid.c_str(), "uid=%s", uid) != 1)
+	if (sscanf(ln_userid.c_str(), "uid=%15s", uid) != 1)
 	{
 		LOG_WARN("Failed to parse cookie jar user ID on disk. Aborting load...");
 		return;
@@ -164,10 +286,39 @@ void cookie_jar::load_cookies_from_disk()
 		return;
 	}
 
+	// Take the cookies from the header we saved...
+	std::string_view rest = ln_cookies;
+	while (!rest.empty())
+	{
+		size_t semi = rest.find(';');
+		cookie_view v;
+		if (v.parse(rest.substr(0, semi)))
+		{
+			merge(v);
+		}
+		rest.remove_prefix(semi == std::string_view::npos ? rest.length() : semi + 1);
+	}
+
+	// ...then their expiries, from the lines after it. (Older jars
+	// don't have these, and their cookies just don't expire.)
+	std::string ln;
+	while (std::getline(f, ln))
+	{
+		cookie_view v;
+		if (v.parse(ln))
+		{
+			merge(v);
+		}
+	}
+
 	// Store all the values.
 	loaded_from_disk = true;
 	user_id = uid;
-	loaded_disk_override = ln_cookies;
+	if (et && !expiry_earliest_init)
+	{
+		expiry_earliest = datetime((std::time_t)et);
+		expiry_earliest_init = true;
+	}
 
-	//LOG_INFO("We are loaded from disk! UID: %s, cookie override: %s", user_id.c_str(), loaded_disk_override.c_str());
+	//LOG_INFO("We are loaded from disk! UID: %s, cookie override: %s", user_id.c_str(), compound.c_str());
 }
@@ -1,4 +1,3 @@
-
 #ifndef COH_COOKIE_JAR_H
 #define COH_COOKIE_JAR_H
 
@@ -6,27 +5,49 @@
  * cookie_jar.h
  * - Stores cookies and provides helper methods
  *   associated with them.
+ * - Cookies are kept by name. A new one with the same name replaces
+ *   the old in place, and one that has already expired deletes it.
+ *   Every response's cookies are merged in, even into a jar loaded
+ *   from disk, so a session the site rotates or extends stays ours.
+ * - The Cookie header is built when a cookie changes, not each time
+ *   a request asks for it.
+ * - Changes after the jar is validated are written back lazily, at
+ *   most every COH_COOKIE_JAR_SAVE_SECS and when the jar goes away.
+ * - Safe to use from several threads at once.
  */
 
+#include "cookie.h"
 #include "datetime.h"
 
-struct cookie;
-
 class cookie_jar
 {
 public:
-	cookie_jar();
+	// Loads the jar on disk unless told not to. (A jar for logging in
+	// again starts empty and with no path, and is attached to the file
+	// once it has replaced the old jar.)
+	cookie_jar(const std::string& p=COH_COOKIE_JAR_PATH, bool load=true);
 	~cookie_jar();
 
-	// Add a cookie to the cookie jar.
-	void add_cookie(cookie* const);
+	// Add a cookie to the cookie jar, from a Set-Cookie header.
+	void add_cookie(std::string_view);
+
+	// Add every cookie a response set.
+	void add_cookies(const httplib::Headers&);
 
-	// Get a string of all the cookies concatenated together.
-	std::string get_compound_string(void) const;
+	// Get a string of all the cookies concatenated together,
+	// for the Cookie header. It's kept built, but we hand out a copy:
+	// responses on other threads can rebuild it once the lock is let go,
+	// and each request keeps its own Cookie string anyway.
+	inline std::string get_compound_string(void) const
+	{
+		std::lock_guard<std::mutex> lk(mtx);
+		return compound;
+	}
 
 	// Get user ID
 	inline std::string get_user_id(void) const 
 	{
+		std::lock_guard<std::mutex> lk(mtx);
 		return user_id;
 	}
 
@@ -36,20 +57,55 @@ public:
 		return loaded_from_disk;
 	}
 
+	// Whether any cookie expires. (Session cookies don't.)
+	inline bool expiry_has(void) const
+	{
+		std::lock_guard<std::mutex> lk(mtx);
+		return expiry_earliest_init;
+	}
+
+	// When the first cookie expires. Only valid if expiry_has().
+	inline datetime expiry_get(void) const
+	{
+		std::lock_guard<std::mutex> lk(mtx);
+		return expiry_earliest;
+	}
+
 	// Mark all the cookies as validated, meaning
 	// everything is there, and can be re-used later on.
 	// This method will write the cookies to a file which will
 	// be loaded with the program.
 	void validate(const char*);
 
+	// Write the jar out if cookies changed since it was last written,
+	// and it has been long enough. (Or straight away, if forced.)
+	void persist(bool force=false);
+
+	// Stop writing to disk, as a newer jar has replaced this one.
+	// (Requests still in flight may use it until they're done.)
+	void detach(void);
+
+	// Start writing to disk at a path, saving now if we're validated.
+	void attach(const std::string&);
+
 private:
-	// List of cookies.
-	std::vector<cookie*> content;
+	// Where the jar lives on disk. Empty once detached.
+	std::string path;
+
+	// Guards everything below.
+	mutable std::mutex mtx;
+
+	// List of cookies. Few enough that finding one by name is
+	// quickest done by looking at each.
+	std::vector<cookie> content;
+
+	// The Cookie header for them.
+	std::string compound;
 
-	// User ID string.
+	// User ID string. Empty until validated.
 	std::string user_id;
 	
-	// The earliest expiry date in cookie jar.
+	// The earliest expiry time in cookie jar.
 	// If this expires, we assume the whole thing
 	// is expired.
 	datetime expiry_earliest; 
@@ -57,10 +113,22 @@ private:
 	bool expiry_earliest_init;
 
 	// Whether the settings were loaded from the disk.
-	// We need this flag as the load is very partial,
-	// as cookies themselves are not objects :w
 	bool loaded_from_disk;
-	std::string loaded_disk_override;
+
+	// Whether cookies changed since we last wrote the file, and when that was.
+	bool dirty;
+	std::time_t saved_at;
+
+private:
+	// Add a parsed cookie. Returns true if anything changed.
+	bool merge(const cookie_view&);
+
+	// Work out the earliest expiry, and the header, again.
+	void expiry_update(void);
+	void compound_update(void);
+
+	// Write the file.
+	void save(void);
 
 	// Attempt to load a cookie jar from disk.
 	// If we can and they aren't expired, they will be used.
@@ -25,22 +25,23 @@ struct datetime
 	datetime(const int d, const int m, const int y,
 		const int hr=0, const int min=0)
 	{
-		std::tm* t;
+		std::tm t;
 		std::time_t raw;
 
 		// Fill these in and call mktime.
+		// (gmtime_r, as sync workers construct these concurrently.)
 		time(&raw);
-		t = gmtime(&raw);
-		t->tm_year = y - 1900;
-		t->tm_mon  = m - 1;
-		t->tm_mday = d;
+		gmtime_r(&raw, &t);
+		t.tm_year = y - 1900;
+		t.tm_mon  = m - 1;
+		t.tm_mday = d;
 
 		// Optional hour/minutes.
-		t->tm_hour = hr;
-		t->tm_min  = min;
-		t->tm_sec  = 0;
+		t.tm_hour = hr;
+		t.tm_min  = min;
+		t.tm_sec  = 0;
 
-		time_utc = mktime(t);
+		time_utc = mktime(&t);
 	}
 
 	// Get the local time.
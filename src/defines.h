@@ -30,11 +30,29 @@
 #define COH_CACHE_DELIM "\x1D"
 #define COH_CACHE_RETRV_DATE_FORMAT "%04u-%02u-%02u %02u:%02u"
 
+// Freshness policy. How long (in seconds) a cached day is shown before
+// it gets revalidated in the background. Past days are never revalidated.
+#define COH_CACHE_TTL_TODAY  (30 * 60)
+#define COH_CACHE_TTL_FUTURE (24 * 60 * 60)
+
+// Fetch scheduler (fetch_scheduler.h).
+#define COH_SCHED_WORKERS    3 // Fetches in flight at once.
+#define COH_SCHED_RESERVED   1 // Workers only interactive fetches may use.
+
+// Append-only log of timetable changes.
+#define COH_CHANGE_LOG_NAME "changes.log"
+#define COH_CHANGE_LOG_PATH COH_CACHE_DIR COH_CHANGE_LOG_NAME
+
 // Retreival defines.
 #define COH_SZ_RETR_PROMPT "Press R to refresh."
 #define COH_SZ_RETR_LAST "Retrieved "
 
 // Window manager defines
+#define COH_WND_POLL_MS 250   // How often to look for work if the UI loop couldn't be set up.
+#define COH_WND_RESIZE_MS 50  // Wait for resizing to settle this long before redrawing.
+#define COH_WND_KEY_BYTES_BUDGET 2048 // Most terminal output a key press should cost.
+#define COH_WND_NAV_SETTLE_MS 80  // Held navigation keys only load the day they stop on after this long.
+#define COH_WND_NAV_PREFETCH 7    // Most days scrolled past to prefetch.
 #define COH_SZ_LOADING "Loading..."
 #define COH_SZ_NOEVENTS "No events this day"
 #define COH_WND_HEADER_TEXT (COH_PROGRAM_NAME " - " COH_PROGRAM_VERSION)
@@ -49,6 +67,7 @@
 // Window manager, main window stuff.
 #define COH_WND_MAIN_TITLE_OFFSY 2    // Y Offset of the date title.
 #define COH_WND_MAIN_PERIODS_OFFSY 4  // Y Offset of the actual periods.
+#define COH_WND_EVENTS_OFFSY (COH_WND_MAIN_TITLE_OFFSY + 2) // Y Offset of the events list.
 #define COH_WND_MAIN_PERIODS_OFFSX 12 // X Offset of ''    ''      ''
 
 // Colour pairs
@@ -70,8 +89,58 @@
 #define COH_COL_PERIOD_FG_STRIDE 4 // Use this to convert between blackfg and whitefg colours.
 #define COH_WND_STRETCH -1         // Set this to stretch along axis.
 
+// Watch mode. Poll intervals are in seconds, and get some jitter
+// (plus or minus COH_WATCH_JITTER_PCT percent) added.
+#define COH_WATCH_INTERVAL_SCHOOL  (5 * 60)       // Weekdays, before and during school.
+#define COH_WATCH_INTERVAL_EVENING (30 * 60)      // Weekday evenings.
+#define COH_WATCH_INTERVAL_IDLE    (3 * 60 * 60)  // Nights and weekends.
+#define COH_WATCH_SCHOOL_BEGIN_HR  6
+#define COH_WATCH_SCHOOL_END_HR    16
+#define COH_WATCH_EVENING_END_HR   22
+#define COH_WATCH_JITTER_PCT       15
+#define COH_WATCH_BACKOFF_MIN      30             // First retry after an error.
+#define COH_WATCH_BACKOFF_MAX      (60 * 60)      // Longest we back off for.
+
+// Request policy (request_policy.h).
+#define COH_NET_RETRIES            3    // Retries after the first attempt.
+#define COH_NET_BACKOFF_BASE_MS    500  // Backoff before the first retry.
+#define COH_NET_BACKOFF_MAX_MS     8000 // Longest backoff between retries.
+#define COH_NET_RETRY_AFTER_MAX    60   // Longest 429 Retry-After (seconds) we wait out.
+#define COH_NET_RATE_PER_SEC       4    // Requests per second to the host...
+#define COH_NET_RATE_BURST         8    // ...with bursts of up to this many.
+#define COH_NET_BREAKER_THRESHOLD  5    // Failures in a row before the breaker opens.
+#define COH_NET_BREAKER_COOLDOWN   30   // Seconds the breaker stays open.
+#define COH_NET_WAIT_SLICE_MS      50   // How often waits check for cancellation.
+
+// Request deadlines (request_ctx.h) and timeouts.
+#define COH_NET_CONNECT_TIMEOUT      10     // Seconds to wait for a connection.
+#define COH_NET_DEADLINE_LOGIN_MS    60000  // Whole login sequence.
+#define COH_NET_DEADLINE_RETRIEVE_MS 30000  // One day's timetable.
+
+// Batch sync (sync_engine.h). Each account gets COH_SYNC_DIR/<username>/.
+#define COH_SYNC_DIR        "./" COH_PROGRAM_NAME_LOWER "-accounts/"
+#define COH_SYNC_CACHE_NAME "cache/"
+#define COH_SYNC_JAR_NAME   COH_PROGRAM_NAME_LOWER ".cookiejar"
+#define COH_SYNC_DAYS       7 // Days to fetch, from --from (or today).
+#define COH_SYNC_JOBS       32 // Accounts synced at once.
+
+// Event loop for batch sync (net_loop.h).
+#define COH_NET_LOOP_EVENTS    64    // Events taken per epoll_wait.
+#define COH_NET_LOOP_REDIRECTS 10    // Redirects followed per request.
+#define COH_NET_READ_CHUNK     16384 // Bytes read at a time.
+#define COH_NET_POOL_PER_HOST  8     // Connections to one host (school) at once.
+#define COH_NET_POOL_IDLE_MS   30000 // Idle connections are closed after this.
+#define COH_NET_HOST_RATE      16    // Requests per second to one host, across accounts...
+#define COH_NET_HOST_BURST     16    // ...with bursts of up to this many.
+
+// Keeping the session warm (session_manager.h).
+#define COH_SESSION_PROBE_SECS   600 // Ask the site if the session is good this often...
+#define COH_SESSION_REFRESH_SECS 600 // ...and log in again this long before it expires.
+#define COH_SESSION_RETRY_SECS   60  // Shortest wait between checks.
+
 // Path defines.
 #define COH_COOKIE_JAR_PATH "./" COH_PROGRAM_NAME_LOWER ".cookiejar"
+#define COH_COOKIE_JAR_SAVE_SECS 60 // Changed cookies are written at most this often.
 #define COH_PREFS_FILE_PATH "./" COH_PROGRAM_NAME_LOWER ".prefs"
 
 // Preferences.
@@ -80,6 +149,8 @@
 #define COH_PREF_NAME_PAUTH "auth"
 #define COH_PREF_NAME_PTT "tt"
 #define COH_PREF_NAME_PLOGOFF "logoff"
+#define COH_PREF_NAME_WHOOK "watch_hook"
+#define COH_PREF_NAME_CREDHELPER "cred_helper"
 #define COH_PREF_MODE_ALIASES_BEGIN "aliases_begin"
 #define COH_PREF_MODE_ALIASES_END "aliases_end"
 
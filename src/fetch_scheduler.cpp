@@ -0,0 +1,321 @@
+
+/*
+ * fetch_scheduler.cpp
+ * Implementations of fetch_scheduler.h methods.
+ */
+
+#include "pch.h"
+#include "application.h"
+#include "datetime.h"
+#include "datetime_dmy.h"
+#include "fetch_scheduler.h"
+#include "request_ctx.h"
+#include "tt_day.h"
+#include "tt_period.h"
+
+// Start the workers.
+fetch_scheduler::fetch_scheduler(application* const a, unsigned worker_count,
+		void(*cb_fetched)(const fetch_result&))
+	// We need at least one worker for background work
+	// on top of the one kept for interactive work.
+	: app(a), n_workers(std::max(worker_count, (unsigned)COH_SCHED_RESERVED + 1)),
+	bg_in_flight(0), stopping(false), on_fetched(cb_fetched)
+{
+	LOG_INFO("Starting fetch scheduler with %u workers.", n_workers);
+
+	memset(stats, 0, sizeof(stats));
+
+	// (The workers look at n_workers, not at this as it grows.)
+	workers.reserve(n_workers);
+	for (unsigned i = 0; i < n_workers; ++i)
+	{
+		workers.emplace_back(&fetch_scheduler::worker_loop, this);
+	}
+}
+
+// Stop and join the workers. Anything in flight is cancelled,
+// so this doesn't wait out a slow request.
+fetch_scheduler::~fetch_scheduler()
+{
+	{
+		std::lock_guard<std::mutex> lk(mtx);
+		stopping = true;
+		for (auto it = jobs.begin(); it != jobs.end(); ++it)
+		{
+			*it->second.cancel = true;
+		}
+	}
+	cv.notify_all();
+
+	for (unsigned i = 0; i < workers.size(); ++i)
+	{
+		workers[i].join();
+	}
+
+	// Leave the numbers in the log.
+	for (int c = 0; c < FETCH_CLASS_COUNT; ++c)
+	{
+		fetch_metrics m = metrics((fetch_class)c);
+		LOG_INFO("Fetches (%s): %lu done, %lu failed, waited %lu ms avg, %lu ms max.",
+			class_str((fetch_class)c), m.done, m.failed, m.wait_avg_ms, m.wait_max_ms);
+	}
+	LOG_INFO("Fetch scheduler stopped.");
+}
+
+// Queue a date. If it's already queued or in flight we only
+// raise its class.
+void fetch_scheduler::submit(const datetime_dmy& d, fetch_class cls,
+	void(*cb_prog)(uint64_t, uint64_t))
+{
+	int id = datetime_dmy_id(d).id;
+	{
+		std::lock_guard<std::mutex> lk(mtx);
+		if (stopping)
+		{
+			return;
+		}
+
+		auto it = jobs.find(id);
+		if (it != jobs.end() && it->second.running && *it->second.cancel)
+		{
+			// Cancelled, but its worker hasn't finished yet. Take it
+			// back with a fresh token, and the worker queues it again
+			// when it's done. (Its result went with the old token.)
+			job& j = it->second;
+			j.cls         = cls;
+			j.on_progress = cb_prog;
+			j.queued_at   = clock::now();
+			j.cancel      = std::make_shared<std::atomic<bool>>(false);
+			LOG_INFO("Revived cancelled ID:%d (%s).", id, class_str(cls));
+			return;
+		}
+		else if (it != jobs.end())
+		{
+			job& j = it->second;
+			if (cb_prog)
+			{
+				j.on_progress = cb_prog;
+			}
+			if (cls >= j.cls)
+			{
+				return;
+			}
+
+			// Move it up. One in flight keeps going, but
+			// reports as the new class when it's done.
+			LOG_INFO("Raising ID:%d from %s to %s.", id, class_str(j.cls), class_str(cls));
+			if (!j.running)
+			{
+				unqueue(id, j.cls);
+				queues[cls].push_back(id);
+			}
+			j.cls = cls;
+		}
+		else
+		{
+			jobs[id] = { d, cls, false, clock::now(), cb_prog,
+				std::make_shared<std::atomic<bool>>(false) };
+			queues[cls].push_back(id);
+			LOG_INFO("Queued ID:%d (%s).", id, class_str(cls));
+		}
+	}
+	cv.notify_all();
+}
+
+// Cancel a class.
+void fetch_scheduler::cancel(fetch_class cls)
+{
+	std::lock_guard<std::mutex> lk(mtx);
+	for (auto it = jobs.begin(); it != jobs.end(); )
+	{
+		job& j = it->second;
+		if (j.cls != cls)
+		{
+			++it;
+			continue;
+		}
+
+		// Running ones are removed by their worker.
+		if (j.running)
+		{
+			*j.cancel = true;
+			++it;
+		}
+		else
+		{
+			unqueue(it->first, cls);
+			it = jobs.erase(it);
+		}
+	}
+}
+
+// Get the statistics of a class.
+fetch_metrics fetch_scheduler::metrics(fetch_class cls) const
+{
+	std::lock_guard<std::mutex> lk(mtx);
+	const class_stats& s = stats[cls];
+	fetch_metrics m;
+	m.queued      = queues[cls].size();
+	m.in_flight   = s.in_flight;
+	m.done        = s.done;
+	m.failed      = s.failed;
+	m.wait_avg_ms = s.done ? s.wait_total_ms / s.done : 0;
+	m.wait_max_ms = s.wait_max_ms;
+	return m;
+}
+
+// Name of a class.
+const char* fetch_scheduler::class_str(fetch_class cls)
+{
+	switch (cls)
+	{
+		case (FETCH_INTERACTIVE): return "interactive";
+		case (FETCH_REVALIDATE):  return "revalidate";
+		case (FETCH_PREFETCH):    return "prefetch";
+		default: break;
+	}
+	return "unknown";
+}
+
+// Pull jobs off the queues until we're told to stop.
+void fetch_scheduler::worker_loop(void)
+{
+	while (true)
+	{
+		// Take a job.
+		int id;
+		datetime_dmy d;
+		fetch_class started_as;
+		void(*cb_prog)(uint64_t, uint64_t);
+		std::shared_ptr<std::atomic<bool>> cancel;
+		unsigned long waited_ms;
+		{
+			std::unique_lock<std::mutex> lk(mtx);
+			cv.wait(lk, [this] { return stopping || can_dispatch(); });
+			if (stopping)
+			{
+				return;
+			}
+			id = pick();
+			job& j = jobs[id];
+			j.running  = true;
+			d          = j.date;
+			started_as = j.cls;
+			cb_prog    = j.on_progress;
+			cancel     = j.cancel;
+			waited_ms  = (unsigned long)std::chrono::duration_cast<std::chrono::milliseconds>(
+				clock::now() - j.queued_at).count();
+
+			++stats[started_as].in_flight;
+			if (started_as != FETCH_INTERACTIVE)
+			{
+				++bg_in_flight;
+			}
+		}
+
+		// Fetch it. This also updates the memory and disk caches.
+		// A prefetch is only a guess, so it doesn't spend a request
+		// on a day we already have fresh. (Looking is a disk read,
+		// which is why it's done here and not by whoever queued it.)
+		fetch_result r;
+		r.date = d;
+		r.changed = false;
+		if (started_as == FETCH_PREFETCH && app->get_tt_for_day_if_cached(r.day, d)
+			&& !app->is_stale(r.day, d))
+		{
+			r.ok = true;
+		}
+		else
+		{
+			request_ctx ctx(COH_NET_DEADLINE_RETRIEVE_MS, cancel.get(), cb_prog);
+			r.ok = app->get_tt_for_day_update(r.day, d, &r.changed, nullptr, ctx);
+		}
+		r.cancelled = *cancel;
+
+		// Done with it. Count it against the class it ended up as.
+		{
+			std::lock_guard<std::mutex> lk(mtx);
+			job& j = jobs[id];
+
+			--stats[started_as].in_flight;
+			if (started_as != FETCH_INTERACTIVE)
+			{
+				--bg_in_flight;
+			}
+
+			// Cancelled, then asked for again while we were at it.
+			// Start over rather than report what the cancel left us.
+			if (r.cancelled && j.cancel != cancel && !stopping)
+			{
+				j.running = false;
+				queues[j.cls].push_back(id);
+				cv.notify_all();
+				continue;
+			}
+
+			r.cls = j.cls;
+			jobs.erase(id);
+
+			class_stats& s = stats[r.cls];
+			++s.done;
+			if (!r.ok) { ++s.failed; }
+			s.wait_total_ms += waited_ms;
+			s.wait_max_ms = std::max(s.wait_max_ms, waited_ms);
+		}
+
+		// A worker is free, which may let background work through.
+		cv.notify_all();
+
+		if (!r.cancelled)
+		{
+			on_fetched(r);
+		}
+	}
+}
+
+// Interactive work can always go. Background work can only go
+// if there's a worker left over after the reserved ones.
+bool fetch_scheduler::can_dispatch(void) const
+{
+	if (!queues[FETCH_INTERACTIVE].empty())
+	{
+		return true;
+	}
+	if (bg_in_flight + COH_SCHED_RESERVED >= n_workers)
+	{
+		return false;
+	}
+	for (int c = FETCH_INTERACTIVE + 1; c < FETCH_CLASS_COUNT; ++c)
+	{
+		if (!queues[c].empty())
+		{
+			return true;
+		}
+	}
+	return false;
+}
+
+// Take the next ID to fetch.
+int fetch_scheduler::pick(void)
+{
+	fetch_class cls = FETCH_INTERACTIVE;
+	for (int c = FETCH_INTERACTIVE; c < FETCH_CLASS_COUNT; ++c)
+	{
+		if (!queues[c].empty())
+		{
+			cls = (fetch_class)c;
+			break;
+		}
+	}
+
+	int id = queues[cls].front();
+	queues[cls].pop_front();
+	return id;
+}
+
+// Take an ID out of a queue.
+void fetch_scheduler::unqueue(int id, fetch_class cls)
+{
+	std::deque<int>& q = queues[cls];
+	q.erase(std::remove(q.begin(), q.end(), id), q.end());
+}
@@ -0,0 +1,141 @@
+#ifndef COH_FETCH_SCHEDULER_H
+#define COH_FETCH_SCHEDULER_H
+
+/*
+ * fetch_scheduler.h
+ * - Fetches days on a fixed number of worker threads, so we never
+ *   have more than that many requests in flight.
+ * - Work comes in priority classes. Interactive work (the day the
+ *   user asked for) always goes first, and one worker is kept back
+ *   for it so it never waits behind background traffic.
+ * - Background classes go in priority order and may use all of the
+ *   remaining workers.
+ * - The same date is never queued twice. Asking for it again with a
+ *   higher class just raises its priority.
+ * - Queue depth and wait times are kept per class.
+ */
+
+#include "datetime.h"
+#include "datetime_dmy.h"
+#include "tt_day.h"
+
+class application;
+
+// Priority classes, highest first.
+enum fetch_class : char
+{
+	FETCH_INTERACTIVE = 0, // The user is waiting on it.
+	FETCH_REVALIDATE  = 1, // Stale day the user is looking at.
+	FETCH_PREFETCH    = 2, // Day the user might look at soon.
+	FETCH_CLASS_COUNT = 3
+};
+
+// What a fetch came back with.
+struct fetch_result
+{
+	datetime_dmy date;
+	tt_day day;        // Only valid if ok.
+	fetch_class cls;   // Class it finished as. (It may have been raised.)
+	bool ok;
+	bool changed;      // Content differs from what we had cached.
+	bool cancelled;
+};
+
+// Per-class statistics.
+struct fetch_metrics
+{
+	unsigned queued;         // Waiting right now.
+	unsigned in_flight;      // Being fetched right now.
+	unsigned long done;      // Finished, successfully or not.
+	unsigned long failed;    // Of those, how many failed.
+	unsigned long wait_avg_ms; // Average time spent queued.
+	unsigned long wait_max_ms; // Longest time spent queued.
+};
+
+class fetch_scheduler
+{
+public:
+	fetch_scheduler(application* const, unsigned,
+		void(*cb_fetched)(const fetch_result&)
+	);
+	~fetch_scheduler();
+
+	// Queue a date. The progress callback (if any) is
+	// called from the worker as data arrives.
+	void submit(const datetime_dmy&, fetch_class,
+		void(*cb_prog)(uint64_t, uint64_t)=nullptr);
+
+	// Cancel every fetch of a class, queued or in flight.
+	void cancel(fetch_class);
+
+	// Get the statistics of a class.
+	fetch_metrics metrics(fetch_class) const;
+
+	// Name of a class.
+	static const char* class_str(fetch_class);
+
+private:
+	typedef std::chrono::steady_clock clock;
+
+	// A queued or in-flight fetch.
+	struct job
+	{
+		datetime_dmy date;
+		fetch_class cls;
+		bool running;
+		clock::time_point queued_at;
+		void(*on_progress)(uint64_t, uint64_t);
+		std::shared_ptr<std::atomic<bool>> cancel;
+	};
+
+	// Running totals of a class.
+	struct class_stats
+	{
+		unsigned in_flight;
+		unsigned long done;
+		unsigned long failed;
+		unsigned long wait_total_ms;
+		unsigned long wait_max_ms;
+	};
+
+	// The application we fetch through.
+	application* app;
+
+	// How many workers we have. Set before any of them start.
+	const unsigned n_workers;
+
+	// Our worker threads.
+	std::vector<std::thread> workers;
+
+	// Every queued or in-flight job by date ID, and the
+	// queued IDs of each class in the order they came in.
+	std::unordered_map<int, job> jobs;
+	std::deque<int> queues[FETCH_CLASS_COUNT];
+	class_stats stats[FETCH_CLASS_COUNT];
+
+	// Background jobs running.
+	unsigned bg_in_flight;
+
+	// Guards the above.
+	mutable std::mutex mtx;
+	std::condition_variable cv;
+	bool stopping;
+
+	// Called (from a worker thread!) when a fetch finishes.
+	void(*on_fetched)(const fetch_result&);
+
+private:
+	// Worker thread loop.
+	void worker_loop(void);
+
+	// Whether a worker may take something now. (Lock held.)
+	bool can_dispatch(void) const;
+
+	// Take the next job's ID off the queues. (Lock held.)
+	int pick(void);
+
+	// Take an ID out of a queue. (Lock held.)
+	void unqueue(int, fetch_class);
+};
+
+#endif
@@ -8,6 +8,17 @@
 /*
  * Note that all the original Server-specific code has been stripped from here
  * as it is not needed for this project.
+ *
+ * LOCAL FORK: this copy is also patched, so don't just drop a newer
+ * upstream release over it. Carry these changes across:
+ * - Client::send is virtual, and create_client_socket/handle_request
+ *   are protected, so SSLClient can keep a connection alive.
+ * - SSLClient keeps one idle connection between requests (take_idle,
+ *   keep_idle), can open it ahead of time (warm_up), and loads its CA
+ *   only once. A GET/HEAD on a kept connection that went stale is
+ *   sent again on a new one.
+ * - Response::wire_length counts body bytes as they came off the wire.
+ * - Inflating a body accepts Z_BUF_ERROR, for pieces that end mid-block.
  */
 
 #ifndef CPPHTTPLIB_HTTPLIB_H
@@ -20,6 +31,9 @@
 // OpenSSL support.
 #define CPPHTTPLIB_OPENSSL_SUPPORT
 
+// Zlib support, for gzip/deflate responses.
+#define CPPHTTPLIB_ZLIB_SUPPORT
+
 #ifndef CPPHTTPLIB_KEEPALIVE_TIMEOUT_SECOND
 #define CPPHTTPLIB_KEEPALIVE_TIMEOUT_SECOND 5
 #endif
@@ -313,6 +327,9 @@ struct Response {
   Headers headers;
   std::string body;
 
+  // Body bytes as they came off the wire, before any decoding.
+  uint64_t wire_length = 0;
+
   bool has_header(const char *key) const;
   std::string get_header_value(const char *key, size_t id = 0) const;
   size_t get_header_value_count(const char *key) const;
@@ -571,7 +588,7 @@ public:
 
   std::shared_ptr<Response> Options(const char *path, const Headers &headers);
 
-  bool send(const Request &req, Response &res);
+  virtual bool send(const Request &req, Response &res);
 
   bool send(const std::vector<Request> &requests,
             std::vector<Response> &responses);
@@ -674,13 +691,14 @@ protected:
     logger_ = rhs.logger_;
   }
 
-private:
   socket_t create_client_socket() const;
+  bool handle_request(Stream &strm, const Request &req, Response &res,
+                      bool last_connection, bool &connection_close);
+
+private:
   bool read_response_line(Stream &strm, Response &res);
   bool write_request(Stream &strm, const Request &req, bool last_connection);
   bool redirect(const Request &req, Response &res);
-  bool handle_request(Stream &strm, const Request &req, Response &res,
-                      bool last_connection, bool &connection_close);
 #ifdef CPPHTTPLIB_OPENSSL_SUPPORT
   bool connect(socket_t sock, Response &res, bool &error);
 #endif
@@ -750,7 +768,21 @@ public:
 
   SSL_CTX *ssl_context() const noexcept;
 
+  // Sends on a kept-alive connection if there is one, and keeps the
+  // connection afterwards if the server lets us.
+  bool send(const Request &req, Response &res) override;
+
+  // Connect and handshake now, and keep the connection for the next
+  // request.
+  bool warm_up();
+
 private:
+  bool connect_ssl(socket_t &sock, SSL *&ssl);
+  bool handshake(SSL *ssl);
+  void close_ssl(socket_t sock, SSL *ssl);
+  bool take_idle(socket_t &sock, SSL *&ssl);
+  void keep_idle(socket_t sock, SSL *ssl);
+
   bool process_and_close_socket(
       socket_t sock, size_t request_count,
       std::function<bool(Stream &strm, bool last_connection,
@@ -771,6 +803,12 @@ private:
   std::string ca_cert_dir_path_;
   bool server_certificate_verification_ = false;
   long verify_result_ = 0;
+  bool ca_cert_loaded_ = false;
+
+  // One connection kept alive between requests.
+  std::mutex idle_mutex_;
+  socket_t idle_sock_ = INVALID_SOCKET;
+  SSL *idle_ssl_ = nullptr;
 };
 #endif
 
@@ -1584,7 +1622,9 @@ public:
       }
     } while (strm.avail_out == 0);
 
-    return ret == Z_OK || ret == Z_STREAM_END;
+    // Z_BUF_ERROR just means the last output buffer was filled exactly,
+    // and there was no more input to go on with.
+    return ret == Z_OK || ret == Z_STREAM_END || ret == Z_BUF_ERROR;
   }
 
 private:
@@ -1770,6 +1810,13 @@ bool read_content(Stream &strm, T &x, size_t payload_max_length, int &status,
   }
 #endif
 
+  // Count the body as it comes off the wire, before it's decoded.
+  ContentReceiver decode = out;
+  out = [&](const char *buf, size_t n) {
+    x.wire_length += n;
+    return decode(buf, n);
+  };
+
   auto ret = true;
   auto exceed_payload_max_length = false;
 
@@ -3700,6 +3747,7 @@ inline SSLClient::SSLClient(const std::string &host, int port,
 }
 
 inline SSLClient::~SSLClient() {
+  if (idle_ssl_) { close_ssl(idle_sock_, idle_ssl_); }
   if (ctx_) { SSL_CTX_free(ctx_); }
 }
 
@@ -3721,6 +3769,154 @@ inline long SSLClient::get_openssl_verify_result() const {
 
 inline SSL_CTX *SSLClient::ssl_context() const noexcept { return ctx_; }
 
+inline bool SSLClient::send(const Request &req, Response &res) {
+  if (!is_valid() || !proxy_host_.empty()) { return Client::send(req, res); }
+
+  socket_t sock;
+  SSL *ssl;
+  auto reused = take_idle(sock, ssl);
+  if (!reused && !connect_ssl(sock, ssl)) { return false; }
+
+  auto connection_close = false;
+  auto ret = false;
+  {
+    detail::SSLSocketStream strm(sock, ssl, read_timeout_sec_,
+                                 read_timeout_usec_);
+    ret = handle_request(strm, req, res, false, connection_close);
+  }
+
+  // The server may have closed a kept connection just as we sent on
+  // it. Nothing came back, so send again on a new one. Only if it's
+  // safe to send twice, though. Anything else goes back to the caller.
+  if (!ret && reused && res.status == -1 &&
+      (req.method == "GET" || req.method == "HEAD")) {
+    close_ssl(sock, ssl);
+    if (!connect_ssl(sock, ssl)) { return false; }
+
+    detail::SSLSocketStream strm(sock, ssl, read_timeout_sec_,
+                                 read_timeout_usec_);
+    connection_close = false;
+    ret = handle_request(strm, req, res, false, connection_close);
+  }
+
+  if (ret && !connection_close) {
+    keep_idle(sock, ssl);
+  } else {
+    close_ssl(sock, ssl);
+  }
+  return ret;
+}
+
+inline bool SSLClient::warm_up() {
+  if (!is_valid() || !proxy_host_.empty()) { return false; }
+
+  socket_t sock;
+  SSL *ssl;
+  if (!connect_ssl(sock, ssl)) { return false; }
+  keep_idle(sock, ssl);
+  return true;
+}
+
+inline bool SSLClient::connect_ssl(socket_t &sock, SSL *&ssl) {
+  sock = create_client_socket();
+  if (sock == INVALID_SOCKET) { return false; }
+
+  {
+    std::lock_guard<std::mutex> guard(ctx_mutex_);
+    ssl = SSL_new(ctx_);
+  }
+  if (!ssl) {
+    detail::close_socket(sock);
+    return false;
+  }
+
+  auto bio = BIO_new_socket(static_cast<int>(sock), BIO_NOCLOSE);
+  SSL_set_bio(ssl, bio, bio);
+  SSL_set_tlsext_host_name(ssl, host_.c_str());
+
+  if (!handshake(ssl)) {
+    close_ssl(sock, ssl);
+    return false;
+  }
+  return true;
+}
+
+inline bool SSLClient::handshake(SSL *ssl) {
+  // The CA certificates only need loading into the context once.
+  {
+    std::lock_guard<std::mutex> guard(ctx_mutex_);
+    if (ca_cert_file_path_.empty()) {
+      SSL_CTX_set_verify(ctx_, SSL_VERIFY_NONE, nullptr);
+    } else if (!ca_cert_loaded_) {
+      if (!SSL_CTX_load_verify_locations(ctx_, ca_cert_file_path_.c_str(),
+                                         nullptr)) {
+        return false;
+      }
+      SSL_CTX_set_verify(ctx_, SSL_VERIFY_PEER, nullptr);
+      ca_cert_loaded_ = true;
+    }
+  }
+
+  if (SSL_connect(ssl) != 1) { return false; }
+
+  if (server_certificate_verification_) {
+    verify_result_ = SSL_get_verify_result(ssl);
+
+    if (verify_result_ != X509_V_OK) { return false; }
+
+    auto server_cert = SSL_get_peer_certificate(ssl);
+
+    if (server_cert == nullptr) { return false; }
+
+    if (!verify_host(server_cert)) {
+      X509_free(server_cert);
+      return false;
+    }
+    X509_free(server_cert);
+  }
+
+  return true;
+}
+
+inline void SSLClient::close_ssl(socket_t sock, SSL *ssl) {
+  SSL_shutdown(ssl);
+  {
+    std::lock_guard<std::mutex> guard(ctx_mutex_);
+    SSL_free(ssl);
+  }
+  detail::close_socket(sock);
+}
+
+inline bool SSLClient::take_idle(socket_t &sock, SSL *&ssl) {
+  {
+    std::lock_guard<std::mutex> guard(idle_mutex_);
+    if (!idle_ssl_) { return false; }
+    sock = idle_sock_;
+    ssl = idle_ssl_;
+    idle_sock_ = INVALID_SOCKET;
+    idle_ssl_ = nullptr;
+  }
+
+  // Anything to read on an idle connection means the server closed it.
+  if (detail::select_read(sock, 0, 0) != 0) {
+    close_ssl(sock, ssl);
+    return false;
+  }
+  return true;
+}
+
+inline void SSLClient::keep_idle(socket_t sock, SSL *ssl) {
+  {
+    std::lock_guard<std::mutex> guard(idle_mutex_);
+    if (!idle_ssl_) {
+      idle_sock_ = sock;
+      idle_ssl_ = ssl;
+      return;
+    }
+  }
+  close_ssl(sock, ssl);
+}
+
 inline bool SSLClient::process_and_close_socket(
     socket_t sock, size_t request_count,
     std::function<bool(Stream &strm, bool last_connection,
@@ -3733,37 +3929,7 @@ inline bool SSLClient::process_and_close_socket(
          detail::process_and_close_socket_ssl(
              true, sock, request_count, read_timeout_sec_, read_timeout_usec_,
              ctx_, ctx_mutex_,
-             [&](SSL *ssl) {
-               if (ca_cert_file_path_.empty()) {
-                 SSL_CTX_set_verify(ctx_, SSL_VERIFY_NONE, nullptr);
-               } else {
-                 if (!SSL_CTX_load_verify_locations(
-                         ctx_, ca_cert_file_path_.c_str(), nullptr)) {
-                   return false;
-                 }
-                 SSL_CTX_set_verify(ctx_, SSL_VERIFY_PEER, nullptr);
-               }
-
-               if (SSL_connect(ssl) != 1) { return false; }
-
-               if (server_certificate_verification_) {
-                 verify_result_ = SSL_get_verify_result(ssl);
-
-                 if (verify_result_ != X509_V_OK) { return false; }
-
-                 auto server_cert = SSL_get_peer_certificate(ssl);
-
-                 if (server_cert == nullptr) { return false; }
-
-                 if (!verify_host(server_cert)) {
-                   X509_free(server_cert);
-                   return false;
-                 }
-                 X509_free(server_cert);
-               }
-
-               return true;
-             },
+             [&](SSL *ssl) { return handshake(ssl); },
              [&](SSL *ssl) {
                SSL_set_tlsext_host_name(ssl, host_.c_str());
                return true;
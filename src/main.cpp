@@ -13,15 +13,30 @@
 
 #include "application.h"
 #include "net_client.h"
+#include "session_manager.h"
+#include "sync_engine.h"
+#include "tt_diff.h"
 #include "tt_period.h"
+#include "ui_loop.h"
+#include "watcher.h"
 #include "wnd_manager.h"
 
 #include "datetime.h"
 #include "datetime_dmy.h"
 #include "tt_day.h"
 
-static datetime_dmy get_dmy_today(void);
 static bool parse_cmd_line(int, char**);
+static int run_watch(void);
+static int run_sync(void);
+
+// Command line options.
+static bool opt_watch = false;
+static bool opt_low_bandwidth = false;
+static bool opt_bandwidth_report = false;
+static const char* opt_sync = nullptr;
+static datetime_dmy opt_sync_from;
+static unsigned opt_sync_days = COH_SYNC_DAYS;
+static unsigned opt_sync_jobs = COH_SYNC_JOBS;
 
 /*
  * Program entry point.
@@ -37,14 +52,45 @@ int main (int argc, char* argv[])
 		return 0;
 	}
 
-	// Initialise window manager.
-	wnd_manager& winman = wnd_manager::get();
+	// Headless modes don't touch the window manager.
+	if (opt_watch)
+	{
+		return run_watch();
+	}
+	if (opt_sync)
+	{
+		return run_sync();
+	}
+
+	// Resizes reach the UI through its loop. No thread may take the
+	// signal itself, so block it before any are started.
+	ui_loop::block_signals();
 
 	// Create main application state.
-	application* app = new application(wnd_manager::cb_date_set);
-	app->set_cur_date(get_dmy_today());
+	application* app = new application(
+		wnd_manager::cb_date_set, wnd_manager::cb_day_fetched
+	);
+
+	// Read prefs before bringing up the UI, so we can start connecting
+	// to the site while ncurses and the cache come up.
+	net_client* client = nullptr;
+	if (app->prefs_check())
+	{
+		// Initialise client with URLs.
+		client = new net_client(app->get_prefs());
+		client->warm_up();
+	}
+
+	// Initialise window manager.
+	wnd_manager& winman = wnd_manager::get();
+	winman.set_low_bandwidth(opt_low_bandwidth);
+	if (opt_bandwidth_report)
+	{
+		winman.meter_start();
+	}
+	app->set_cur_date(application::date_today());
 	winman.set_app(app);
-	if (!app->prefs_check())
+	if (!client)
 	{
 		LOG_ERROR("Prefs file either missing or invalid.");
 
@@ -52,42 +98,80 @@ int main (int argc, char* argv[])
 		winman.show_setup_prompt();
 		return 0;
 	}
-
-	// Initialise client with URLs.
-	net_client* client = new net_client(
-		app->get_prefs(), wnd_manager::cb_login_status_changed
-	);
+	client->login_cb_set(wnd_manager::cb_login_status_changed);
 	app->client_set(client);
 
+	// Keep the session warm in the background.
+	session_manager* sessions = new session_manager(client, app->get_prefs().cred_helper);
+	winman.set_sessions(sessions);
+	sessions->start();
+
 	// Perform initial draw.
 	winman.redraw_initial();
 
 	// Window manager loop.
 	while (winman.update());
 
-	// Cleanup.
-	delete client;
+	// Cleanup. The app and sessions go first, as they use the client.
 	delete app;
+	delete sessions;
+	delete client;
 
 	// Terminated with success.
 	LOG_INFO("Terminating...");
 	return 0;
 }
 
-// Get today's date as datetime_dmy
-static datetime_dmy get_dmy_today(void)
+// Run in watch mode, keeping today and tomorrow fresh.
+static int run_watch(void)
 {
-	// Get current local time.
-	std::time_t n = std::time(0);
-	std::tm now = *(std::localtime(&n));
-
-	// Return object with the correct offsets.
-	return datetime_dmy(
-		now.tm_mday,
-		now.tm_mon + 1,
-		now.tm_year + 1900,
-		now.tm_wday
+	application* app = new application(
+		[](const datetime_dmy&) {},
+		[](const fetch_result&) {}
 	);
+	if (!app->prefs_check())
+	{
+		fprintf(stderr, "Prefs file either missing or invalid.\n");
+		delete app;
+		return 1;
+	}
+
+	// One client for the whole run.
+	net_client* client = new net_client(app->get_prefs());
+	app->client_set(client);
+
+	// With a credential helper, log in if we need to and keep the
+	// session going for as long as we watch.
+	session_manager* sessions = new session_manager(client, app->get_prefs().cred_helper);
+	if (!client->session_exists())
+	{
+		sessions->relogin();
+	}
+	sessions->start();
+
+	watcher w(app, app->get_prefs().watch_hook);
+	int ret = w.run();
+
+	delete app;
+	delete sessions;
+	delete client;
+	return ret;
+}
+
+// Sync every account in the manifest.
+static int run_sync(void)
+{
+	if (!opt_sync_from.year)
+	{
+		opt_sync_from = application::date_today();
+	}
+
+	sync_engine e(opt_sync_from, opt_sync_days, opt_sync_jobs);
+	if (!e.load_manifest(opt_sync))
+	{
+		return 1;
+	}
+	return e.run();
 }
 
 // Parse command line arguments.
@@ -99,13 +183,101 @@ static bool parse_cmd_line(int argc, char* argv[])
 	// Iterate until no arguments left.
 	while (*++argv)
 	{
-		// We only look for a version string for now.
+		// Version string.
 		if (strcmp(*argv, "--version") == 0 ||
 			strcmp(*argv, "-v") == 0)
 		{
 			printf(COH_PROGRAM_NAME " - " COH_PROGRAM_VERSION "\n");
 			return false;
 		}
+
+		// Go easy on slow terminals, and count what we send them.
+		if (strcmp(*argv, "--low-bandwidth") == 0)
+		{
+			opt_low_bandwidth = true;
+			continue;
+		}
+		if (strcmp(*argv, "--bandwidth-report") == 0)
+		{
+			opt_bandwidth_report = true;
+			continue;
+		}
+
+		// Keep today and tomorrow fresh in the background.
+		if (strcmp(*argv, "--watch") == 0)
+		{
+			opt_watch = true;
+			continue;
+		}
+
+		// Sync every account in a manifest, and its options.
+		if (strcmp(*argv, "--sync") == 0)
+		{
+			if (!*(argv + 1))
+			{
+				printf("Usage: --sync MANIFEST\n");
+				return false;
+			}
+			opt_sync = *++argv;
+			continue;
+		}
+		if (strcmp(*argv, "--from") == 0)
+		{
+			unsigned y, m, d;
+			if (!*(argv + 1) || sscanf(*(argv + 1), "%u-%u-%u", &y, &m, &d) != 3)
+			{
+				printf("Usage: --from YYYY-MM-DD\n");
+				return false;
+			}
+			opt_sync_from = application::date_add(datetime_dmy(d, m, y, 0), 0);
+			++argv;
+			continue;
+		}
+		if (strcmp(*argv, "--days") == 0 || strcmp(*argv, "--jobs") == 0)
+		{
+			unsigned n;
+			if (!*(argv + 1) || sscanf(*(argv + 1), "%u", &n) != 1 || n == 0)
+			{
+				printf("Usage: %s N\n", *argv);
+				return false;
+			}
+			(strcmp(*argv, "--days") == 0 ? opt_sync_days : opt_sync_jobs) = n;
+			++argv;
+			continue;
+		}
+
+		// Print logged timetable changes since a local date/time.
+		// Takes YYYY-MM-DD, optionally followed by HH:MM, then optionally
+		// an account directory made by --sync to read its log instead.
+		if (strcmp(*argv, "--changes-since") == 0)
+		{
+			std::tm t = { 0 };
+			int n = *(argv + 1) ? sscanf(*(argv + 1), "%d-%d-%d %d:%d",
+				&t.tm_year, &t.tm_mon, &t.tm_mday, &t.tm_hour, &t.tm_min) : 0;
+			if (n != 3 && n != 5)
+			{
+				printf("Usage: --changes-since \"YYYY-MM-DD [HH:MM]\" [ACCOUNT_DIR]\n");
+				return false;
+			}
+			++argv;
+			t.tm_year -= 1900;
+			t.tm_mon  -= 1;
+			t.tm_isdst = -1;
+
+			std::string path = COH_CHANGE_LOG_PATH;
+			if (*(argv + 1) && **(argv + 1) != '-')
+			{
+				path = *++argv;
+				if (path.back() != '/') { path += '/'; }
+				path += COH_SYNC_CACHE_NAME COH_CHANGE_LOG_NAME;
+			}
+
+			if (tt_diff::log_print_since(mktime(&t), stdout, path) == 0)
+			{
+				printf("No changes logged since then.\n");
+			}
+			return false;
+		}
 	}
 
 	return true;
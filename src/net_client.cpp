@@ -10,12 +10,10 @@
 #include "datetime_dmy.h"
 #include "net_client.h"
 #include "prefs.h"
+#include "stream_scan.h"
 #include "tt_parser.h"
 #include "tt_period.h"
 
-// Typedef this long type.
-typedef std::shared_ptr<httplib::Response> http_resp;
-
 // Use this macro in request methods.
 // Need to make sure the response variable is called "resp".
 // (Undefined at bottom.)
@@ -31,10 +29,13 @@ typedef std::shared_ptr<httplib::Response> http_resp;
 
 // Construct new client.
 net_client::net_client(const prefs& p,
-		void(*cb_lchg)(int))
-	: sslclient(nullptr), cookies(nullptr), hostname(p.hostname),
+		void(*cb_lchg)(int), const std::string& jar_path)
+	: sslclient(nullptr), hostname(p.hostname),
 	path_login(p.path_login), path_auth(p.path_auth),
-	path_timetable(p.path_tt), path_logoff(p.path_logoff)
+	path_timetable(p.path_tt), path_logoff(p.path_logoff),
+	logged_in(false), login_status(-1), bytes_wire(0), bytes_decoded(0),
+	policy(std::make_shared<request_policy>()),
+	jar_path(jar_path)
 {
 	// Print out the URLs to log file.
 	LOG_INFO("Initialising net_client with: \n"
@@ -48,8 +49,9 @@ net_client::net_client(const prefs& p,
 	);
 
 	// Headers
-	std::string header_origin = "https://" + hostname;
-	httplib::Headers headers_base = {
+	header_origin = "https://" + hostname;
+	headers_base = {
+		{ "Accept-Encoding", "gzip, deflate" },
 		{ "Accept-Language", "en-GB,en;q=0.5" },
 		{ "Connection",      "keep-alive" },
 		{ "DNT",             "1" },
@@ -59,28 +61,63 @@ net_client::net_client(const prefs& p,
 		{ "User-Agent",      "Mozilla/5.0 (Linux; rv:70) Firefox/73" }
 	};
 
+	// Every request accepts either the page or anything (JSON).
+	auto l_accepting = [&](const char* accept)
+	{
+		httplib::Headers h = headers_base;
+		h.emplace("Accept", accept);
+		return std::make_shared<const request_headers>(std::move(h));
+	};
+	auto hdr_html = l_accepting("text/html");
+	auto hdr_any  = l_accepting("*/*");
+
+	// Build the login steps' requests.
+	auto l_template = [&](login_step s, const char* method, const std::string& path,
+		const std::shared_ptr<const request_headers>& h, const char* what, const char* ctype)
+	{
+		net_request& r = login_tpl[s];
+		r.method       = method;
+		r.path         = path;
+		r.headers      = h;
+		r.what         = what;
+		r.content_type = ctype;
+	};
+	l_template(LOGIN_GET_PAGE,   "GET",  path_login, hdr_html, "Login page GET", nullptr);
+	l_template(LOGIN_POST_AUTH,  "POST", path_auth,  hdr_any,  "Auth POST",      "application/json");
+	l_template(LOGIN_POST_CREDS, "POST", path_login, hdr_html, "Login POST",     "application/x-www-form-urlencoded");
+	l_template(LOGIN_GET_HOME,   "GET",  "/",        hdr_html, "Home page GET",  nullptr);
+
+	// Follow the home page wherever it sends us.
+	login_tpl[LOGIN_GET_HOME].follow_location = true;
+
+	// Posting the credentials twice could count against the account
+	// (towards a lockout), so that one is only ever sent once.
+	login_tpl[LOGIN_POST_CREDS].retryable = false;
+
 	// Initialise cookie jar.
-	cookies = new cookie_jar();
+	cookies = std::make_shared<cookie_jar>(jar_path);
 
 	// Set our login callback.
 	on_chg_login = cb_lchg;
 
-	// If we loaded from disk, set the status.
-	if (cookies->is_loaded_from_disk())
-	{
-		on_chg_login(COH_STATUS_READDISK);
-	}
-	else
-	{
-		// Not logged in.
-		on_chg_login(COH_STATUS_LOGGEDOFF);
-	}
+	// If we loaded from disk, set the status. Otherwise
+	// we're not logged in.
+	login_status = cookies->is_loaded_from_disk() ?
+		COH_STATUS_READDISK : COH_STATUS_LOGGEDOFF;
+	on_chg_login(login_status);
 }
 
 // Clean up.
 net_client::~net_client()
 {
-	LOG_INFO("Cleaning up net_client...");
+	LOG_INFO("Cleaning up net_client... Received %llu bytes, %llu once decoded.",
+		(unsigned long long)bytes_wire, (unsigned long long)bytes_decoded);
+
+	// Wait for the warm-up, as it uses the SSLClient.
+	if (warm_thr.joinable())
+	{
+		warm_thr.join();
+	}
 
 	// Free SSLClient memory if existant.
 	if (sslclient_exists())
@@ -88,27 +125,16 @@ net_client::~net_client()
 		delete sslclient;
 		LOG_INFO("Freed SSLClient.");
 	}
-
-	// Free cookie jar.
-	if (cookies)
-	{
-		delete cookies;
-	}
 }
 
 // Log into Compass site.
+// Runs each step of login_step in turn, blocking on each request.
 bool net_client::login(
 	const std::string& username,
-	const std::string& password
+	const std::string& password,
+	const request_ctx& ctx
 )
 {
-	// If we are loaded from disk, we don't need to log in again.
-	if (cookies->is_loaded_from_disk())
-	{
-		LOG_INFO("Already loaded from disk. Aborting login.");
-		return true;
-	}
-
 	LOG_INFO("Logging in with username '%s'...", username.c_str());
 
 	// Create SSLClient if we need.
@@ -118,139 +144,186 @@ bool net_client::login(
 		return false;
 	}
 
-	// Steps to log in:
-	// 0.) GET request to login url for cookies.
-	// 1.) POST request to auth url, for another cookie we need.
-	// 2.) POST to the login URL with credentials.
-
-	// Macros we will need.
-	// (May move S_ADD_COOKIES to be a proper method in cookie_jar class)
-#define S_ADD_COOKIES()\
-	/* Iterate over all the cookies and add to cookie jar. */\
-	for (size_t i = 0; i < resp->get_header_value_count("set-cookie"); ++i)\
-	{ cookies->add_cookie(new cookie(resp->get_header_value("set-cookie", i))); }
-
-	// Send the first GET, accepting text/html
-	http_resp resp;
+	// Log in with a fresh jar, not the one retrieving is using.
+	// It has no path until it's swapped in, so it can't write the
+	// file while the old one still might.
+	auto fresh = std::make_shared<cookie_jar>("", false);
+	for (int s = LOGIN_GET_PAGE; s != LOGIN_DONE; ++s)
 	{
-		httplib::Headers headers_get_login = headers_base;
-		headers_get_login.emplace("Accept", "text/html");
-
-		// Send a GET request to login url.
-		resp = sslclient->Get(path_login.c_str(), headers_get_login);
+		net_request req = login_request((login_step)s, username, password, *fresh);
+		http_resp resp = policy->send([&]() { return send_req(req, ctx); }, req.what, req.retryable, ctx);
+		if (!login_response((login_step)s, resp, username, *fresh))
+		{
+			return false;
+		}
 	}
 
-	// Make sure we got a 200, and add cookies.
-	S_CHK_RESP("GET");
-	S_ADD_COOKIES();
-
-	// Send the POST to get authenticated.
+	// Swap it in. The old one mustn't write over the new one's file,
+	// so it lets go of the file before the new one saves there.
 	{
-		httplib::Headers headers_post_auth = headers_base;
-		headers_post_auth.emplace("Accept", "*/*");
-		headers_post_auth.emplace("Cookie", cookies->get_compound_string());
-
-		// Create the JSON payload we want to post.
-		std::string post_payload_auth = "{\"username\":\"" + username + "\"}";
-		LOG_DBUG("POST data: %s", post_payload_auth.c_str());
-
-		// Send a POST request to auth url.
-		resp = sslclient->Post(path_auth.c_str(), headers_post_auth, post_payload_auth, "application/json");
+		std::lock_guard<std::mutex> lk(cookies_mtx);
+		cookies->detach();
+		cookies = fresh;
 	}
+	fresh->attach(jar_path);
+	chg_login_status(COH_STATUS_LOGGEDIN);
+	return true;
+}
 
-	// Check if POST succeeded.
-	S_CHK_RESP("POST");
-	S_ADD_COOKIES();
+// Build a login request with the current jar.
+net_request net_client::login_request(login_step step,
+	const std::string& username, const std::string& password) const
+{
+	return login_request(step, username, password, *jar());
+}
 
-	// Check if a Captcha is required.
-	if (resp->body.compare("{\"d\":false}") == 0)
-	{
-		LOG_DBUG("No authentication required. Can proceed with login.");
-	}
-	else if (resp->body.compare("{\"d\":true}") == 0)
+// Handle a login response with the current jar.
+bool net_client::login_response(login_step step, const http_resp& resp,
+	const std::string& username)
+{
+	if (!login_response(step, resp, username, *jar()))
 	{
-		LOG_WARN("Captcha required... Cannot proceed.");
 		return false;
 	}
-	else
+	if (step == LOGIN_GET_HOME)
 	{
-		LOG_WARN("Unrecognised Captcha response, '%s'", resp->body.c_str());
-		return false;
+		chg_login_status(COH_STATUS_LOGGEDIN);
 	}
+	return true;
+}
 
-	// Add username cookie.
-	cookies->add_cookie(new cookie("username=" + username + ";"));
-
-	// Log into the damn site!
+// Build the request for a step of logging in.
+// Steps to log in:
+// 0.) GET request to login url for cookies.
+// 1.) POST request to auth url, for another cookie we need.
+// 2.) POST to the login URL with credentials.
+// 3.) GET the home page to A.) Check if we were logged in properly,
+//     and B.) get our User ID for schedule requests.
+net_request net_client::login_request(login_step step,
+	const std::string& username, const std::string& password, cookie_jar& cj) const
+{
+	if (step >= LOGIN_DONE)
 	{
-		httplib::Headers headers_post_login = headers_base;
-		headers_post_login.emplace("Accept", "text/html");
-		headers_post_login.emplace("Cookie", cookies->get_compound_string());
-
-		// Create URL-encoded payload.
-		std::string encod_user = util::url_encode(username);
-		std::string encod_pass = util::url_encode(password);
-		std::string post_payload_login = "__EVENTTARGET=button1&username=" + encod_user + "&password=" + encod_pass;
-		LOG_DBUG("POST data: %s", post_payload_login.c_str());
-
-		// Send a POST request to login url.
-		resp = sslclient->Post(path_login.c_str(), headers_post_login, post_payload_login, "application/x-www-form-urlencoded");
+		return net_request();
 	}
 
-	// Check if POST succeeded.
-	S_CHK_RESP("POST");
-
-	sslclient->set_follow_location(true);
-
-	// Get the home page to A.) Check if we were logged in properly,
-	// and B.) get our User ID for schedule requests.
+	// Everything but the cookies and body is in the template.
+	net_request r = login_tpl[step];
+	if (step != LOGIN_GET_PAGE)
 	{
-		httplib::Headers headers_get_home = headers_base;
-		headers_get_home.emplace("Accept", "text/html");
-		headers_get_home.emplace("Cookie", cookies->get_compound_string());
-
-		// Send a GET request to home url.
-		resp = sslclient->Get("/", headers_get_home);
+		r.cookie = cj.get_compound_string();
 	}
 
-	// Make sure we got a 200, and add cookies.
-	S_CHK_RESP("GET");
-
-	// Try to get the User ID from the page.
-	// It is embedded in the page's JavaScript so we just search for it.
-	const std::string USER_ID_SEARCH = "Compass.organisationUserId = ";
-	const size_t USER_ID_SEARCH_LEN = USER_ID_SEARCH.length();
-	size_t useridindex = resp->body.find(USER_ID_SEARCH);
-	if (useridindex == std::string::npos)
+	switch (step)
 	{
-		LOG_ERROR("Couldn't get the user ID from the home page. Cannot retrieve schedule.");
-		return false;
+		// Create the JSON payload we want to post.
+		case (LOGIN_POST_AUTH):
+		{
+			r.body.reserve(16 + username.length());
+			r.body += "{\"username\":\"";
+			r.body += username;
+			r.body += "\"}";
+			LOG_DBUG("POST data: %s", r.body.c_str());
+		} break;
+
+		// Create URL-encoded payload. (Don't log it, it has the password.)
+		case (LOGIN_POST_CREDS):
+		{
+			r.body.reserve(64 + (username.length() + password.length()) * 3);
+			r.body += "__EVENTTARGET=button1&username=";
+			util::url_encode(r.body, username);
+			r.body += "&password=";
+			util::url_encode(r.body, password);
+		} break;
+
+		// We only want the user ID near the top of the home
+		// page, so stop reading once we have it.
+		case (LOGIN_GET_HOME):
+		{
+			auto scan = std::make_shared<stream_scan>(COH_USER_ID_MARKER, ';', COH_USER_ID_MAX);
+			r.scan = [scan](const char* buf, size_t n) { return scan->feed(buf, n); };
+		} break;
+
+		default: break;
 	}
-	useridindex += USER_ID_SEARCH_LEN;
-	std::string userid = resp->body.substr(useridindex, 32);
+	return r;
+}
 
-	// Find the semicolon starting from last index.
-	size_t useridindex_smcln = userid.find(";");
-	if (useridindex_smcln == std::string::npos)
+// Handle the response to a step of logging in.
+bool net_client::login_response(login_step step, const http_resp& resp,
+	const std::string& username, cookie_jar& cj)
+{
+	// Take whatever cookies each step sets.
+	if (resp)
 	{
-		LOG_ERROR("Failed to parse User ID.");
-		return false;
+		cj.add_cookies(resp->headers);
 	}
-	userid[useridindex_smcln] = '\0';
-	LOG_INFO("Got user id: '%s'", userid.c_str());
-
-	// We have all the cookies we need. Mark them as validated
-	// so they can be re-used until expiry date..
-	// (Will be cancelled if we are loaded from disk already.)
-	cookies->validate(userid.c_str());
-
-	// Undefine macros
-#undef S_ADD_COOKIES
 
-	// We are logged in.
-	chg_login_status(COH_STATUS_LOGGEDIN);
+	switch (step)
+	{
+		case (LOGIN_GET_PAGE):
+		{
+			// Make sure we got a 200.
+			S_CHK_RESP("GET");
+		} break;
+
+		case (LOGIN_POST_AUTH):
+		{
+			// Check if POST succeeded.
+			S_CHK_RESP("POST");
+
+			// Check if a Captcha is required.
+			if (resp->body.compare("{\"d\":false}") == 0)
+			{
+				LOG_DBUG("No authentication required. Can proceed with login.");
+			}
+			else if (resp->body.compare("{\"d\":true}") == 0)
+			{
+				LOG_WARN("Captcha required... Cannot proceed.");
+				return false;
+			}
+			else
+			{
+				LOG_WARN("Unrecognised Captcha response, '%s'", resp->body.c_str());
+				return false;
+			}
+
+			// Add username cookie.
+			cj.add_cookie("username=" + username);
+		} break;
+
+		case (LOGIN_POST_CREDS):
+		{
+			// Check if POST succeeded.
+			S_CHK_RESP("POST");
+		} break;
+
+		case (LOGIN_GET_HOME):
+		{
+			// Make sure we got a 200.
+			S_CHK_RESP("GET");
+
+			// Try to get the User ID from the page.
+			// It is embedded in the page's JavaScript so we just search for it.
+			// (We stopped reading the page once we'd seen it.)
+			stream_scan scan(COH_USER_ID_MARKER, ';', COH_USER_ID_MAX);
+			if (!scan.feed(resp->body.data(), resp->body.length()))
+			{
+				LOG_ERROR("Couldn't get the user ID from the home page. Cannot retrieve schedule.");
+				return false;
+			}
+			const std::string& userid = scan.value();
+			LOG_INFO("Got user id: '%s'", userid.c_str());
+
+			// We have all the cookies we need. Mark them as validated
+			// so they can be re-used until expiry date..
+			// (Will be cancelled if we are loaded from disk already.)
+			cj.validate(userid.c_str());
+		} break;
+
+		default: break;
+	}
 
-	// Successful login.
 	return true;
 }
 
@@ -259,9 +332,14 @@ bool net_client::retrieve_data(
 	std::vector<tt_period>& timetable,
 	std::vector<tt_period>& events,
 	const datetime_dmy& dt,
-	const prefs& pref
+	const prefs& pref,
+	std::string& fprint,
+	bool& unchanged,
+	const request_ctx& ctx
 )
 {
+	unchanged = false;
+
 	// Create SSLClient if we need.
 	if (!sslclient_check())
 	{
@@ -272,41 +350,112 @@ bool net_client::retrieve_data(
 	// We need to be sure that we're able to actually request
 	// or not. If we just logged in we can. If we have cookies,
 	// we can assume we can.
-	if (!logged_in && !cookies->is_loaded_from_disk())
+	if (!session_exists())
 	{
 		LOG_ERROR("Cannot retrieve. Neither logged in nor loaded from disk.");
 		return false;
 	}
 
+	net_request req = retrieve_request(dt);
+	http_resp resp = policy->send([&]() { return send_req(req, ctx); }, req.what, req.retryable, ctx);
+	return retrieve_response(resp, timetable, events, dt, pref, fprint, unchanged);
+}
+
+// Build the request for a day's timetable.
+net_request net_client::retrieve_request(const datetime_dmy& dt) const
+{
 	char datestr[16];
 	sprintf(datestr, "%04d-%02d-%02d", dt.year, dt.month, dt.day);
 	LOG_INFO("Attempting to retrieve data for date, %s", datestr);
 
-	// Send the POST to get information.
-	http_resp resp;
+	// Get the template for whoever we're logged in as, building it
+	// the first time. (Or again, if we log in as someone else.)
+	std::shared_ptr<cookie_jar> c = jar();
+	std::string uid = c->get_user_id();
+	std::shared_ptr<const timetable_template> t;
 	{
-		httplib::Headers headers_post_json = headers_base;
-		headers_post_json.emplace("Accept", "*/*");
-		headers_post_json.emplace("Cookie", cookies->get_compound_string());
+		std::lock_guard<std::mutex> lk(tt_mtx);
+		if (!tt_tpl || tt_tpl->uid != uid)
+		{
+			auto n = std::make_shared<timetable_template>();
+			n->uid = uid;
+			n->req.method       = "POST";
+			n->req.path         = path_timetable;
+			n->req.what         = "Timetable POST";
+			n->req.headers      = login_tpl[LOGIN_POST_AUTH].headers; // Accepting anything.
+			n->req.content_type = "application/json";
+
+			// Create the JSON payload we want to post, with the dates blank.
+			std::string& b = n->req.body;
+			b = "{\"startDate\":\"";
+			n->date_at[0] = b.length();
+			b += "YYYY-MM-DD\",\"endDate\":\"";
+			n->date_at[1] = b.length();
+			b += "YYYY-MM-DD\",\"page\":1,\"userId\":";
+			b += uid;
+			b += "}";
+			tt_tpl = n;
+		}
+		t = tt_tpl;
+	}
 
-		// Create the JSON payload we want to post.
-		std::string post_payload_json = "{\"startDate\":\"";
-		post_payload_json += datestr;
-		post_payload_json += "\",\"endDate\":\"";
-		post_payload_json += datestr;
-		post_payload_json += "\",\"page\":1,\"userId\":";
-		post_payload_json += cookies->get_user_id();
-		post_payload_json += "}";
+	// Send the POST to get information.
+	net_request r = t->req;
+	r.cookie = c->get_compound_string();
+	memcpy(&r.body[t->date_at[0]], datestr, 10);
+	memcpy(&r.body[t->date_at[1]], datestr, 10);
 
-		LOG_DBUG("POST data: %s", post_payload_json.c_str());
+	LOG_DBUG("POST data: %s", r.body.c_str());
+	return r;
+}
 
-		// Send a POST request to the timetable url.
-		resp = sslclient->Post(path_timetable.c_str(), headers_post_json, post_payload_json, "application/json");
-	}
+// Handle the response to a timetable request.
+bool net_client::retrieve_response(
+	const http_resp& resp,
+	std::vector<tt_period>& timetable,
+	std::vector<tt_period>& events,
+	const datetime_dmy& dt,
+	const prefs& pref,
+	std::string& fprint,
+	bool& unchanged
+)
+{
+	unchanged = false;
 
 	// Check if POST succeeded.
 	S_CHK_RESP("POST");
 
+	// The site may rotate or extend the session with any response.
+	// Keep up, so the session lasts as long as it will.
+	std::shared_ptr<cookie_jar> c = jar();
+	c->add_cookies(resp->headers);
+	c->persist();
+
+	// S_CHK_RESP lets a redirect through, but here it means the
+	// session died and we're being sent to log in.
+	if (session_lost(resp))
+	{
+		LOG_WARN("Timetable POST: the session has expired (HTTP %d).", resp->status);
+		chg_login_status(COH_STATUS_LOGGEDOFF);
+		return false;
+	}
+
+	char datestr[16];
+	sprintf(datestr, "%04d-%02d-%02d", dt.year, dt.month, dt.day);
+
+	// Skip the parse entirely if it's the same response as last time.
+	// (Only once we have the data can we say that we are logged in.
+	// We just set the state in case we were loaded from disk.)
+	std::string fprint_new = util::json_fingerprint(resp->body);
+	if (!fprint.empty() && fprint_new == fprint)
+	{
+		LOG_INFO("Timetable data unchanged for %s.", datestr);
+		chg_login_status(COH_STATUS_LOGGEDIN);
+		unchanged = true;
+		return true;
+	}
+	fprint = fprint_new;
+
 	// Parse the JSON.
 	if (!tt_parser::parse_json(timetable, events, resp->body, pref))
 	{
@@ -316,15 +465,109 @@ bool net_client::retrieve_data(
 		return false;
 	}
 	LOG_INFO("Timetable data retrieved. Got (%u) periods.", timetable.size());
-
-	// We can say that we are logged in.
-	// We just set the state in case we were loaded
-	// from disk.
 	chg_login_status(COH_STATUS_LOGGEDIN);
 
 	return true;
 }
 
+// Whether the session is gone, going by a timetable response.
+bool net_client::session_lost(const http_resp& resp)
+{
+	if (!resp)
+	{
+		return false;
+	}
+	if (resp->status >= 300 && resp->status < 400)
+	{
+		return true;
+	}
+	return resp->status == 200
+		&& resp->get_header_value("Content-Type").find("text/html") != std::string::npos;
+}
+
+// Whether we can retrieve without logging in.
+bool net_client::session_exists(void) const
+{
+	return logged_in || jar()->is_loaded_from_disk();
+}
+
+// Ask the site whether our session is still good.
+session_state net_client::probe(const request_ctx& ctx)
+{
+	if (!session_exists())
+	{
+		return SESSION_EXPIRED;
+	}
+	if (!sslclient_check())
+	{
+		LOG_ERROR("Cannot probe session. SSLClient failed to create.");
+		return SESSION_UNKNOWN;
+	}
+
+	// A live session gets the home page. A dead one is sent
+	// to the login page, which has no user ID.
+	net_request req = login_request(LOGIN_GET_HOME, "", "");
+	req.what = "Session probe GET";
+	http_resp resp = policy->send([&]() { return send_req(req, ctx); }, req.what, req.retryable, ctx);
+	if (!resp || resp->status >= 500)
+	{
+		LOG_WARN("Session probe got no answer. Can't tell if we're logged in.");
+		return SESSION_UNKNOWN;
+	}
+
+	std::shared_ptr<cookie_jar> c = jar();
+	c->add_cookies(resp->headers);
+	c->persist();
+
+	stream_scan scan(COH_USER_ID_MARKER, ';', COH_USER_ID_MAX);
+	if (resp->status == 200 && scan.feed(resp->body.data(), resp->body.length()))
+	{
+		chg_login_status(COH_STATUS_LOGGEDIN);
+		return SESSION_VALID;
+	}
+
+	LOG_INFO("Session probe: the session has expired (HTTP %d).", resp->status);
+	chg_login_status(COH_STATUS_LOGGEDOFF);
+	return SESSION_EXPIRED;
+}
+
+// When the session's first cookie expires.
+bool net_client::session_expiry(datetime& out) const
+{
+	std::shared_ptr<cookie_jar> c = jar();
+	if (!c->expiry_has())
+	{
+		return false;
+	}
+	out = c->expiry_get();
+	return true;
+}
+
+// Connect in the background.
+// The SSLClient keeps the connection, and the first request takes it.
+void net_client::warm_up(void)
+{
+	warm_thr = std::thread([this]()
+	{
+		auto start = std::chrono::steady_clock::now();
+		if (!sslclient_check() || !sslclient->warm_up())
+		{
+			LOG_WARN("Couldn't connect to %s ahead of time.", hostname.c_str());
+			return;
+		}
+		LOG_INFO("Connected to %s ahead of time in %ld ms.", hostname.c_str(),
+			(long)std::chrono::duration_cast<std::chrono::milliseconds>(
+				std::chrono::steady_clock::now() - start).count());
+	});
+}
+
+// Set the login status callback.
+void net_client::login_cb_set(void(*cb)(int))
+{
+	on_chg_login = cb;
+	on_chg_login(login_status);
+}
+
 // Create the SSLClient.
 bool net_client::sslclient_create(void)
 {
@@ -332,6 +575,7 @@ bool net_client::sslclient_create(void)
 	sslclient = new httplib::SSLClient(hostname, COH_PORT_HTTPS);
 	sslclient->set_ca_cert_path(COH_CA_CERT_PATH);
 	sslclient->enable_server_certificate_verification(true);
+	sslclient->set_timeout_sec(COH_NET_CONNECT_TIMEOUT);
 
 	// Check for errors. (Wrong spot?)
 	auto result = sslclient->get_openssl_verify_result();
@@ -344,19 +588,126 @@ bool net_client::sslclient_create(void)
 	return !!sslclient;
 }
 
+// Send one request.
+// We receive the body ourselves rather than through Progress, which
+// only fires for bodies with a Content-Length. This way every chunk
+// checks the context and reports progress.
+http_resp net_client::send_req(const net_request& r, const request_ctx& ctx)
+{
+	httplib::Request req;
+	req.method  = r.method;
+	req.path    = r.path;
+	if (r.headers)
+	{
+		req.headers = r.headers->list;
+	}
+	if (!r.cookie.empty())
+	{
+		req.headers.emplace("Cookie", r.cookie);
+	}
+	if (r.content_type)
+	{
+		req.headers.emplace("Content-Type", r.content_type);
+		req.body = r.body;
+	}
+
+	std::string recvd;
+	uint64_t total = 0;
+	int status = -1;
+	httplib::Headers headers;
+	bool scanned = false;
+	std::shared_ptr<httplib::Response> resp;
+
+	// Called for each response's headers. Following a redirect
+	// gives us a new one, so start the body over.
+	req.response_handler = [&](const httplib::Response& res)
+	{
+		recvd.clear();
+		status = res.status;
+		headers = res.headers;
+		total = strtoull(res.get_header_value("Content-Length").c_str(), nullptr, 10);
+		return !ctx.should_stop();
+	};
+
+	// Called for each chunk of the body, once it's decoded. Progress
+	// is in bytes off the wire, as that's what Content-Length counts.
+	req.content_receiver = [&](const char* buf, size_t n)
+	{
+		recvd.append(buf, n);
+		if (ctx.on_progress)
+		{
+			ctx.on_progress(resp->wire_length, total);
+		}
+		if (r.scan && r.scan(buf, n))
+		{
+			scanned = true;
+			return false;
+		}
+		return !ctx.should_stop();
+	};
+
+	// Follow same-host redirects ourselves, like net_loop. The client
+	// is shared, so turning its own following on would make every
+	// request follow, even the login POST that mustn't.
+	for (unsigned redirects = 0; ; ++redirects)
+	{
+		resp = std::make_shared<httplib::Response>();
+		if (!sslclient->send(req, *resp))
+		{
+			// Stopping once the scan had what it wanted isn't a failure.
+			// (httplib doesn't hand back a response it didn't finish.)
+			if (!scanned)
+			{
+				return nullptr;
+			}
+			resp->status  = status;
+			resp->headers = std::move(headers);
+		}
+		resp->body = std::move(recvd);
+		traffic_add(r.what, resp);
+
+		std::string loc = resp->get_header_value("Location");
+		if (!r.follow_location || resp->status < 300 || resp->status >= 400 || loc.empty())
+		{
+			return resp;
+		}
+		std::string origin = "https://" + hostname;
+		if (loc.compare(0, origin.length(), origin) == 0)
+		{
+			loc.erase(0, origin.length());
+			if (loc.empty()) { loc = "/"; }
+		}
+		if (loc[0] != '/' || redirects == COH_NET_LOOP_REDIRECTS)
+		{
+			return resp;
+		}
+		req.path = loc;
+		recvd.clear();
+	}
+}
+
+// Count a response's body.
+void net_client::traffic_add(const char* what, const http_resp& resp)
+{
+	bytes_wire    += resp->wire_length;
+	bytes_decoded += resp->body.length();
+	if (resp->wire_length != resp->body.length())
+	{
+		LOG_DBUG("%s: %llu bytes on the wire, %zu decoded.", what,
+			(unsigned long long)resp->wire_length, resp->body.length());
+	}
+}
+
 // Change the login status.
 void net_client::chg_login_status(int to)
 {
-	static int login_status = -1;
-
 	// logged_in means we are 100% logged into the site.
 	logged_in = (to == COH_STATUS_LOGGEDIN);
 
 	// Call the callback if status actually changed.
-	if (to != login_status)
+	if (login_status.exchange(to) != to)
 	{
 		on_chg_login(to);
-		login_status = to;
 	}
 }
 
@@ -10,34 +10,168 @@
 #define COH_CA_CERT_PATH "./ca-bundle.crt"
 #define COH_PORT_HTTPS 443
 
+// Where the home page gives the user ID, and its longest length.
+#define COH_USER_ID_MARKER "Compass.organisationUserId = "
+#define COH_USER_ID_MAX    31
+
+#include "request_ctx.h"
+#include "request_policy.h"
+
 // Forward declare these.
 class cookie_jar;
 struct cookie;
+struct datetime;
 struct datetime_dmy;
 struct prefs;
 struct tt_period;
 
+// The steps of logging in. Each is one request.
+enum login_step : char
+{
+	LOGIN_GET_PAGE   = 0, // GET the login page, for cookies.
+	LOGIN_POST_AUTH  = 1, // POST the auth URL, for another cookie.
+	LOGIN_POST_CREDS = 2, // POST the credentials.
+	LOGIN_GET_HOME   = 3, // GET the home page, for the user ID.
+	LOGIN_DONE       = 4
+};
+
+// What a probe found out about the session.
+enum session_state : char
+{
+	SESSION_VALID   = 0,
+	SESSION_EXPIRED = 1, // The site wants us to log in again.
+	SESSION_UNKNOWN = 2  // Couldn't tell. (No answer, or a server error.)
+};
+
+// Headers an endpoint sends with every request, built once per
+// client and shared by its requests. Kept as httplib wants them,
+// and as they go on the wire for net_loop.
+struct request_headers
+{
+	httplib::Headers list;
+	std::string wire; // "Name: value\r\n" for each.
+
+	request_headers(httplib::Headers h)
+		: list(std::move(h))
+	{
+		for (auto& kv : list)
+		{
+			wire += kv.first;
+			wire += ": ";
+			wire += kv.second;
+			wire += "\r\n";
+		}
+	}
+};
+
+// A request to send to the site.
+struct net_request
+{
+	const char* method;
+	std::string path;
+	std::shared_ptr<const request_headers> headers; // May be null.
+	std::string cookie;       // The Cookie header. Empty for none.
+	std::string body;
+	const char* content_type; // Null if there's no body.
+	const char* what;         // What it is, for logging.
+	bool follow_location;     // Follow redirects?
+	bool retryable;           // Safe to send again if it fails?
+
+	// If set, called with each piece of the body as it arrives.
+	// Returning true stops reading there, and the response is
+	// whatever came before.
+	std::function<bool(const char*, size_t)> scan;
+
+	net_request()
+		: method("GET"), content_type(nullptr), what(""), follow_location(false), retryable(true)
+	{}
+};
+
 class net_client
 {
 public:
 	// Initialise the client.
 	net_client(const prefs&,
-		void(*cb_lchg)(int)=[](int b){}
+		void(*cb_lchg)(int)=[](int b){},
+		const std::string& jar_path=COH_COOKIE_JAR_PATH
 	);
 	~net_client();
 
-	// Log into the site
-	bool login(const std::string&, const std::string&);
+	// Log into the site. The new session only replaces the one
+	// we have (if any) once it's complete, so retrieving can carry
+	// on with the old one in the meantime.
+	bool login(const std::string&, const std::string&,
+		const request_ctx& ctx=request_ctx(COH_NET_DEADLINE_LOGIN_MS));
 
 	// Get timetable information.
-	bool retrieve_data(std::vector<tt_period>&, std::vector<tt_period>&, const datetime_dmy&, const prefs&);
+	// The fingerprint passed in is what we already have. It is replaced
+	// with the response's fingerprint, and if they match the vectors are
+	// left alone and unchanged is set.
+	bool retrieve_data(std::vector<tt_period>&, std::vector<tt_period>&, const datetime_dmy&, const prefs&,
+		std::string& fprint, bool& unchanged,
+		const request_ctx& ctx=request_ctx(COH_NET_DEADLINE_RETRIEVE_MS));
+
+	// Build the request for a step of logging in, and handle its
+	// response. The response handler returns false if logging in
+	// failed. login() runs these in order, but an event loop can
+	// run them too. (See session_task.h)
+	net_request login_request(login_step, const std::string&, const std::string&) const;
+	bool login_response(login_step, const http_resp&, const std::string&);
+
+	// The same for retrieving a day.
+	net_request retrieve_request(const datetime_dmy&) const;
+	bool retrieve_response(const http_resp&, std::vector<tt_period>&, std::vector<tt_period>&,
+		const datetime_dmy&, const prefs&, std::string& fprint, bool& unchanged);
+
+	// Whether a timetable response means the session is gone: we
+	// were redirected (to the login page), or got a page, not JSON.
+	static bool session_lost(const http_resp&);
+
+	// Get the policy every request goes through.
+	inline request_policy& policy_get(void)
+	{
+		return *policy;
+	}
+
+	// Share a policy with other clients, so that limits apply to the
+	// host as a whole rather than to each account. Set it before
+	// sending anything.
+	inline void policy_share(const std::shared_ptr<request_policy>& p)
+	{
+		policy = p;
+	}
+
+	// Get the host domain.
+	inline const std::string& get_hostname(void) const
+	{
+		return hostname;
+	}
 
 	// Log out of site.
 	void logoff(void);
 
+	// Whether we have a session we can retrieve with,
+	// either from logging in or from disk.
+	bool session_exists(void) const;
+
+	// Ask the site whether the session is still good. This is the
+	// login's home page GET, so it only reads as far as the user ID.
+	session_state probe(const request_ctx& ctx=request_ctx(COH_NET_DEADLINE_LOGIN_MS));
+
+	// When the session's first cookie expires. Returns false if
+	// none of them do, and only the site knows.
+	bool session_expiry(datetime&) const;
+
+	// Look up the host, connect and handshake in the background,
+	// so the first request finds a connection ready for it.
+	void warm_up(void);
+
+	// Set what's told about login status changes, and tell it
+	// the status now.
+	void login_cb_set(void(*)(int));
+
 private:
 	httplib::SSLClient* sslclient; // Our main HTTPS client.
-	cookie_jar* cookies;           // Store cookies here.
 	std::string hostname;          // Host domain.
 	std::string path_login;        // Login path.
 	std::string path_auth;         // Authentication path.
@@ -48,19 +182,76 @@ private:
 	std::string header_origin;
 	httplib::Headers headers_base;
 
-	// Whether we are logged in or not.
-	bool logged_in;
+	// Each login step's request, less its cookies and body. Built
+	// once, and copied for each request. (See login_request)
+	net_request login_tpl[LOGIN_DONE];
+
+	// The timetable request for a user, with blanks for the dates.
+	// Each request copies it, and writes its date over the blanks.
+	struct timetable_template
+	{
+		std::string uid;
+		net_request req;
+		size_t date_at[2]; // Where the dates go in the body.
+	};
+	mutable std::shared_ptr<const timetable_template> tt_tpl;
+	mutable std::mutex tt_mtx;
+
+	// Whether we are logged in or not, and the last status
+	// we told the callback about. (Revalidation workers
+	// update these too.)
+	std::atomic<bool> logged_in;
+	std::atomic<int> login_status;
+
+	// Response body bytes, as they came off the wire and decoded.
+	std::atomic<uint64_t> bytes_wire;
+	std::atomic<uint64_t> bytes_decoded;
+
+	// Retries, rate limiting and circuit breaking for every request.
+	// May be shared with other clients of the same host.
+	std::shared_ptr<request_policy> policy;
+
+	// Guards lazy creation of the SSLClient.
+	std::mutex sslclient_mtx;
+
+	// Connects ahead of the first request. (See warm_up)
+	std::thread warm_thr;
+
+	// Store cookies here. Logging in fills a new jar and swaps it in,
+	// so take a reference with jar() and a jar never changes under
+	// anyone using it.
+	std::shared_ptr<cookie_jar> cookies;
+	mutable std::mutex cookies_mtx;
+	std::string jar_path;
 
 	// Callbacks.
 	void(*on_chg_login)(int);
 
 private:
+	// The current cookie jar.
+	inline std::shared_ptr<cookie_jar> jar(void) const
+	{
+		std::lock_guard<std::mutex> lk(cookies_mtx);
+		return cookies;
+	}
+
+	// The login steps, filling the given jar.
+	net_request login_request(login_step, const std::string&, const std::string&, cookie_jar&) const;
+	bool login_response(login_step, const http_resp&, const std::string&, cookie_jar&);
+
 	// Creates the SSL client.
 	bool sslclient_create(void);
 
 	// Login status changed.
 	void chg_login_status(int);
 
+	// Count a response's body.
+	void traffic_add(const char*, const http_resp&);
+
+	// Send one request, stopping when the context says so.
+	// Returns null on failure.
+	http_resp send_req(const net_request&, const request_ctx&);
+
 	// Return whether the SSLClient exists.
 	inline bool sslclient_exists(void) const
 	{
@@ -70,6 +261,7 @@ private:
 	// Check for SSLClient exist. If not, try create.
 	inline bool sslclient_check(void)
 	{
+		std::lock_guard<std::mutex> lk(sslclient_mtx);
 		if (!sslclient_exists())
 		{
 			return sslclient_create();
@@ -0,0 +1,804 @@
+
+/*
+ * net_loop.cpp
+ * Implementations of net_loop.h methods.
+ */
+
+#include "pch.h"
+#include "net_loop.h"
+
+// Constructor.
+net_loop::net_loop()
+	: epfd(-1), ssl_ctx(nullptr), n_jobs(0), bytes_wire(0), bytes_decoded(0)
+{
+	epfd = epoll_create1(EPOLL_CLOEXEC);
+	if (epfd < 0)
+	{
+		LOG_ERROR("Couldn't create epoll instance: %s", strerror(errno));
+		return;
+	}
+
+	// Verify the server the same way net_client does.
+	ssl_ctx = SSL_CTX_new(TLS_client_method());
+	if (!ssl_ctx)
+	{
+		LOG_ERROR("Couldn't create SSL context.");
+		return;
+	}
+	SSL_CTX_set_verify(ssl_ctx, SSL_VERIFY_PEER, nullptr);
+#ifdef SSL_OP_IGNORE_UNEXPECTED_EOF
+	// Bodies without a length end when the server hangs up,
+	// which it may do without a close_notify.
+	SSL_CTX_set_options(ssl_ctx, SSL_OP_IGNORE_UNEXPECTED_EOF);
+#endif
+	if (SSL_CTX_load_verify_locations(ssl_ctx, COH_CA_CERT_PATH, nullptr) != 1)
+	{
+		LOG_ERROR("Couldn't load CA certificates from '%s'.", COH_CA_CERT_PATH);
+		SSL_CTX_free(ssl_ctx);
+		ssl_ctx = nullptr;
+	}
+}
+
+// Destructor. Anything still in flight is dropped.
+net_loop::~net_loop()
+{
+	for (auto& i : conns)
+	{
+		if (i.second->ssl) { SSL_free(i.second->ssl); }
+		close(i.first);
+		delete i.second;
+	}
+	if (ssl_ctx) { SSL_CTX_free(ssl_ctx); }
+	if (epfd >= 0) { close(epfd); }
+}
+
+// Whether we're usable.
+bool net_loop::is_ready(void) const
+{
+	return epfd >= 0 && ssl_ctx;
+}
+
+// Send a request.
+void net_loop::submit(const std::string& host, const net_request& req,
+	unsigned long timeout_ms, on_done_fn cb)
+{
+	++n_jobs;
+	pools[host].waiting.push_back(
+		{ req, 0, clock::now() + std::chrono::milliseconds(timeout_ms), std::move(cb) });
+	dispatch(host);
+}
+
+// Call a function later.
+void net_loop::after(unsigned long ms, std::function<void(void)> fn)
+{
+	timers.emplace(clock::now() + std::chrono::milliseconds(ms), std::move(fn));
+}
+
+// Run until there's nothing left to do.
+void net_loop::run(void)
+{
+	epoll_event evs[COH_NET_LOOP_EVENTS];
+	while (n_jobs || !timers.empty() || !done.empty())
+	{
+		int n = done.empty() ? epoll_wait(epfd, evs, COH_NET_LOOP_EVENTS, next_wake()) : 0;
+		if (n < 0 && errno != EINTR)
+		{
+			LOG_ERROR("epoll_wait failed: %s", strerror(errno));
+			break;
+		}
+
+		// Move along whatever is ready. (A connection that was
+		// dropped earlier in the batch is already gone from the map.)
+		for (int i = 0; i < n; ++i)
+		{
+			auto it = conns.find(evs[i].data.fd);
+			if (it != conns.end())
+			{
+				step(it->second);
+			}
+		}
+
+		// Give up on requests that are out of time, and close
+		// connections that have been idle too long.
+		clock::time_point now = clock::now();
+		// Idle or busy is decided here. Finishing a busy one may hand
+		// an idle one new work, so the idle ones go first.
+		std::vector<conn*> idle_expired, busy_expired;
+		for (auto& i : conns)
+		{
+			conn* c = i.second;
+			if (c->state == CONN_IDLE)
+			{
+				if (now - c->idle_since >= std::chrono::milliseconds(COH_NET_POOL_IDLE_MS))
+				{
+					idle_expired.push_back(c);
+				}
+			}
+			else if (now >= c->j.deadline)
+			{
+				busy_expired.push_back(c);
+			}
+		}
+		for (unsigned i = 0; i < idle_expired.size(); ++i)
+		{
+			drop(idle_expired[i]);
+		}
+		for (unsigned i = 0; i < busy_expired.size(); ++i)
+		{
+			LOG_WARN("%s: timed out.", busy_expired[i]->j.req.what);
+			finish(busy_expired[i], nullptr);
+		}
+		for (auto& i : pools)
+		{
+			std::deque<job>& w = i.second.waiting;
+			for (auto it = w.begin(); it != w.end(); )
+			{
+				if (now < it->deadline)
+				{
+					++it;
+					continue;
+				}
+				LOG_WARN("%s: timed out waiting for a connection to %s.", it->req.what, i.first.c_str());
+				complete(*it, nullptr);
+				it = w.erase(it);
+			}
+		}
+
+		// Fire timers that are due. Taken out first, since they
+		// may add more.
+		std::vector<std::function<void(void)>> due;
+		while (!timers.empty() && timers.begin()->first <= now)
+		{
+			due.push_back(std::move(timers.begin()->second));
+			timers.erase(timers.begin());
+		}
+		for (unsigned i = 0; i < due.size(); ++i)
+		{
+			due[i]();
+		}
+
+		// Hand back finished requests. Same again.
+		std::vector<std::pair<on_done_fn, http_resp>> fin;
+		fin.swap(done);
+		for (unsigned i = 0; i < fin.size(); ++i)
+		{
+			fin[i].first(fin[i].second);
+		}
+	}
+}
+
+// Start what the host has room for.
+void net_loop::dispatch(const std::string& host)
+{
+	host_pool& p = pools[host];
+	while (!p.waiting.empty())
+	{
+		// A warm connection if there is one, else a new one if
+		// we're under the limit, else it waits.
+		conn* c = nullptr;
+		if (!p.idle.empty())
+		{
+			c = p.idle.back();
+			p.idle.pop_back();
+		}
+		else if (p.open < COH_NET_POOL_PER_HOST)
+		{
+			c = open(host, 0);
+		}
+		else
+		{
+			break;
+		}
+
+		job j = std::move(p.waiting.front());
+		p.waiting.pop_front();
+		if (!c)
+		{
+			complete(j, nullptr);
+			continue;
+		}
+		assign(c, std::move(j));
+	}
+}
+
+// Open a connection.
+net_loop::conn* net_loop::open(const std::string& host, unsigned addr)
+{
+	const std::vector<sockaddr_storage>* a = is_ready() ? resolve(host) : nullptr;
+	if (!a)
+	{
+		return nullptr;
+	}
+
+	// Go through the addresses until one doesn't fail outright.
+	for (; addr < a->size(); ++addr)
+	{
+		const sockaddr_storage& sa = (*a)[addr];
+		int fd = socket(sa.ss_family, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+		if (fd < 0)
+		{
+			LOG_ERROR("Couldn't create socket: %s", strerror(errno));
+			return nullptr;
+		}
+		int one = 1;
+		setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+
+		socklen_t len = sa.ss_family == AF_INET6 ? sizeof(sockaddr_in6) : sizeof(sockaddr_in);
+		if (connect(fd, (const sockaddr*)&sa, len) != 0 && errno != EINPROGRESS)
+		{
+			LOG_DBUG("Address %u of %s failed (%s).", addr + 1, host.c_str(), strerror(errno));
+			close(fd);
+			continue;
+		}
+
+		// Connected or connecting. We hear about it when it's writable.
+		epoll_event ev;
+		ev.events = EPOLLOUT;
+		ev.data.fd = fd;
+		if (epoll_ctl(epfd, EPOLL_CTL_ADD, fd, &ev) != 0)
+		{
+			LOG_ERROR("epoll_ctl failed: %s", strerror(errno));
+			close(fd);
+			return nullptr;
+		}
+
+		conn* c = new conn;
+		c->fd = fd;
+		c->ssl = nullptr;
+		c->state = CONN_CONNECTING;
+		c->host = host;
+		c->addr = addr;
+		c->served = 0;
+		conns[fd] = c;
+		++pools[host].open;
+		return c;
+	}
+
+	LOG_ERROR("Couldn't connect to %s.", host.c_str());
+	return nullptr;
+}
+
+// Put a request on a connection.
+void net_loop::assign(conn* c, job&& j)
+{
+	c->j = std::move(j);
+	const net_request& req = c->j.req;
+
+	// Write out the request.
+	c->out.clear();
+	c->out.reserve(512 + req.body.length());
+	c->out += req.method;
+	c->out += ' ';
+	c->out += req.path;
+	c->out += " HTTP/1.1\r\n";
+	if (!req.headers || req.headers->list.find("Host") == req.headers->list.end())
+	{
+		c->out += "Host: ";
+		c->out += c->host;
+		c->out += "\r\n";
+	}
+
+	// The endpoint's headers are already written out.
+	if (req.headers)
+	{
+		c->out += req.headers->wire;
+	}
+	if (!req.cookie.empty())
+	{
+		c->out += "Cookie: ";
+		c->out += req.cookie;
+		c->out += "\r\n";
+	}
+	if (req.content_type)
+	{
+		char len[24];
+		snprintf(len, sizeof(len), "%zu", req.body.length());
+		c->out += "Content-Type: ";
+		c->out += req.content_type;
+		c->out += "\r\nContent-Length: ";
+		c->out += len;
+		c->out += "\r\n";
+	}
+	c->out += "\r\n";
+	if (req.content_type)
+	{
+		c->out += req.body;
+	}
+	c->out_pos = 0;
+
+	c->in.clear();
+	c->resp = nullptr;
+	c->body_pos = 0;
+	c->take_pos = 0;
+	c->content_len = -1;
+	c->chunked = false;
+	c->keep_alive = false;
+
+	// A pooled connection can start writing as soon as it's able.
+	// A new one is still connecting, and carries on from there.
+	if (c->state == CONN_IDLE)
+	{
+		c->state = CONN_WRITING;
+		want(c, true);
+	}
+}
+
+// Move a connection along.
+void net_loop::step(conn* c)
+{
+	// The server closed it (or sent something it shouldn't)
+	// while it sat in the pool.
+	if (c->state == CONN_IDLE)
+	{
+		drop(c);
+		return;
+	}
+
+	// Finished connecting. Start TLS.
+	if (c->state == CONN_CONNECTING)
+	{
+		int err = 0;
+		socklen_t len = sizeof(err);
+		if (getsockopt(c->fd, SOL_SOCKET, SO_ERROR, &err, &len) != 0 || err)
+		{
+			if (err == EINPROGRESS) { return; }
+			connect_failed(c, err);
+			return;
+		}
+
+		c->ssl = SSL_new(ssl_ctx);
+		if (!c->ssl
+			|| SSL_set_fd(c->ssl, c->fd) != 1
+			|| SSL_set_tlsext_host_name(c->ssl, c->host.c_str()) != 1
+			|| SSL_set1_host(c->ssl, c->host.c_str()) != 1)
+		{
+			LOG_ERROR("%s: couldn't set up TLS.", c->j.req.what);
+			finish(c, nullptr);
+			return;
+		}
+		SSL_set_connect_state(c->ssl);
+		c->state = CONN_HANDSHAKE;
+	}
+
+	// Go as far as we can. Every TLS call may want to read or write,
+	// whatever we're doing, so we wait on whichever it asks for.
+	for (;;)
+	{
+		int r;
+		if (c->state == CONN_HANDSHAKE)
+		{
+			r = SSL_do_handshake(c->ssl);
+			if (r == 1)
+			{
+				c->state = CONN_WRITING;
+				continue;
+			}
+		}
+		else if (c->state == CONN_WRITING)
+		{
+			r = SSL_write(c->ssl, c->out.data() + c->out_pos, (int)(c->out.length() - c->out_pos));
+			if (r > 0)
+			{
+				c->out_pos += r;
+				if (c->out_pos == c->out.length())
+				{
+					c->state = CONN_READING;
+					c->out.clear();
+				}
+				continue;
+			}
+		}
+		else
+		{
+			char buf[COH_NET_READ_CHUNK];
+			r = SSL_read(c->ssl, buf, sizeof(buf));
+			if (r > 0)
+			{
+				c->in.append(buf, r);
+				int p = parse(c, false);
+				if (p != 0)
+				{
+					finish(c, p > 0 ? c->resp : nullptr);
+					return;
+				}
+				continue;
+			}
+		}
+
+		int e = SSL_get_error(c->ssl, r);
+		if (e == SSL_ERROR_WANT_READ || e == SSL_ERROR_WANT_WRITE)
+		{
+			want(c, e == SSL_ERROR_WANT_WRITE);
+			return;
+		}
+
+		// The server closed the connection. Fine if we were reading
+		// and the body runs to the end.
+		if (c->state == CONN_READING
+			&& (e == SSL_ERROR_ZERO_RETURN || e == SSL_ERROR_SYSCALL))
+		{
+			int p = parse(c, true);
+			if (p > 0)
+			{
+				finish(c, c->resp);
+				return;
+			}
+		}
+		ERR_clear_error();
+
+		// A pooled connection the server closed before we got anything
+		// back. That's a race, not a failure, so go again on another.
+		// (Only if it's safe to send twice. A POST may have been acted
+		// on, so that one fails, and request_policy decides.)
+		if (c->served && c->in.empty() && is_idempotent(c->j.req.method))
+		{
+			LOG_DBUG("%s: pooled connection to %s was closed. Retrying.", c->j.req.what, c->host.c_str());
+			std::string host = c->host;
+			pools[host].waiting.push_front(std::move(c->j));
+			drop(c);
+			dispatch(host);
+			return;
+		}
+
+		LOG_ERROR("%s: TLS error (%d), connection closed.", c->j.req.what, e);
+		finish(c, nullptr);
+		return;
+	}
+}
+
+// Couldn't connect.
+void net_loop::connect_failed(conn* c, int err)
+{
+	LOG_DBUG("%s: address %u of %s failed (%s).",
+		c->j.req.what, c->addr + 1, c->host.c_str(), strerror(err));
+
+	// Try the rest of the host's addresses.
+	conn* n = c->addr + 1 < addrs[c->host].size() ? open(c->host, c->addr + 1) : nullptr;
+	if (n)
+	{
+		assign(n, std::move(c->j));
+		drop(c);
+		return;
+	}
+
+	LOG_ERROR("%s: couldn't connect to %s: %s", c->j.req.what, c->host.c_str(), strerror(err));
+	finish(c, nullptr);
+}
+
+// Change what we wait on.
+void net_loop::want(conn* c, bool writable)
+{
+	epoll_event ev;
+	ev.events = writable ? EPOLLOUT : EPOLLIN;
+	ev.data.fd = c->fd;
+	epoll_ctl(epfd, EPOLL_CTL_MOD, c->fd, &ev);
+}
+
+// Parse what we've read.
+int net_loop::parse(conn* c, bool eof)
+{
+	// Status line and headers.
+	if (!c->resp)
+	{
+		size_t end = c->in.find("\r\n\r\n");
+		if (end == std::string::npos)
+		{
+			return eof ? -1 : 0;
+		}
+
+		http_resp r = std::make_shared<httplib::Response>();
+		int status;
+		char version[16];
+		if (sscanf(c->in.c_str(), "%15s %d", version, &status) != 2)
+		{
+			LOG_ERROR("%s: malformed status line.", c->j.req.what);
+			return -1;
+		}
+		r->version = version;
+		r->status = status;
+
+		size_t pos = c->in.find("\r\n") + 2;
+		while (pos < end)
+		{
+			size_t eol = c->in.find("\r\n", pos);
+			size_t colon = c->in.find(':', pos);
+			if (colon != std::string::npos && colon < eol)
+			{
+				size_t vpos = c->in.find_first_not_of(" \t", colon + 1);
+				vpos = std::min(vpos, eol);
+				r->headers.emplace(c->in.substr(pos, colon - pos), c->in.substr(vpos, eol - vpos));
+			}
+			pos = eol + 2;
+		}
+
+		c->chunked = strcasecmp(r->get_header_value("Transfer-Encoding").c_str(), "chunked") == 0;
+		if (!c->chunked && r->has_header("Content-Length"))
+		{
+			c->content_len = atol(r->get_header_value("Content-Length").c_str());
+		}
+
+		// No body at all.
+		if (status == 204 || status == 304 || (status >= 100 && status < 200))
+		{
+			c->content_len = 0;
+		}
+
+		// We can only use it again if it's HTTP/1.1, the server didn't
+		// say otherwise, and we'll know where the body ends.
+		c->keep_alive = r->version == "HTTP/1.1"
+			&& strcasecmp(r->get_header_value("Connection").c_str(), "close") != 0
+			&& (c->chunked || c->content_len >= 0);
+
+		// We asked for gzip or deflate, and may get either.
+		std::string enc = r->get_header_value("Content-Encoding");
+		c->inflate.reset();
+		if (enc.find("gzip") != std::string::npos || enc.find("deflate") != std::string::npos)
+		{
+			c->inflate.reset(new httplib::detail::decompressor());
+			if (!c->inflate->is_valid())
+			{
+				LOG_ERROR("%s: couldn't set up decoding.", c->j.req.what);
+				return -1;
+			}
+		}
+
+		c->resp = r;
+		c->body_pos = end + 4;
+		c->take_pos = c->body_pos;
+	}
+
+	// Chunked. Decode whole chunks as they arrive.
+	if (c->chunked)
+	{
+		for (;;)
+		{
+			size_t eol = c->in.find("\r\n", c->body_pos);
+			if (eol == std::string::npos)
+			{
+				return eof ? -1 : 0;
+			}
+			char* hex_end;
+			unsigned long sz = strtoul(c->in.c_str() + c->body_pos, &hex_end, 16);
+			if (hex_end == c->in.c_str() + c->body_pos)
+			{
+				LOG_ERROR("%s: malformed chunk.", c->j.req.what);
+				return -1;
+			}
+			if (sz == 0)
+			{
+				// Last chunk. Skip any trailers, up to the blank line.
+				size_t t = c->in.find("\r\n\r\n", eol);
+				if (t == std::string::npos)
+				{
+					return eof ? -1 : 0;
+				}
+				if (t + 4 != c->in.length())
+				{
+					c->keep_alive = false;
+				}
+				return 1;
+			}
+			if (c->in.length() < eol + 2 + sz + 2)
+			{
+				return eof ? -1 : 0;
+			}
+			int t = take(c, c->in.data() + eol + 2, sz);
+			c->body_pos = eol + 2 + sz + 2;
+			if (t)
+			{
+				return t;
+			}
+		}
+	}
+
+	// Take what's new of an unchunked body.
+	size_t body_end = c->content_len >= 0
+		? std::min(c->in.length(), c->body_pos + c->content_len) : c->in.length();
+	if (body_end > c->take_pos)
+	{
+		int t = take(c, c->in.data() + c->take_pos, body_end - c->take_pos);
+		c->take_pos = body_end;
+		if (t)
+		{
+			return t;
+		}
+	}
+
+	// Content-Length, or up to the end.
+	size_t have = c->in.length() - c->body_pos;
+	if (c->content_len >= 0 && have >= (size_t)c->content_len)
+	{
+		// Anything past the body means we're out of step with the
+		// server. Don't use it again.
+		if (have > (size_t)c->content_len)
+		{
+			c->keep_alive = false;
+		}
+		return 1;
+	}
+	if (c->content_len < 0 && eof)
+	{
+		return 1;
+	}
+	return eof ? -1 : 0;
+}
+
+// Take a piece of the body.
+int net_loop::take(conn* c, const char* p, size_t n)
+{
+	std::string& body = c->resp->body;
+	size_t before = body.length();
+	c->resp->wire_length += n;
+	bytes_wire += n;
+
+	if (!c->inflate)
+	{
+		body.append(p, n);
+	}
+	else if (!c->inflate->decompress(p, n,
+		[&body](const char* d, size_t dn) { body.append(d, dn); return true; }))
+	{
+		LOG_ERROR("%s: couldn't decode the body.", c->j.req.what);
+		return -1;
+	}
+	bytes_decoded += body.length() - before;
+
+	// Stopping early leaves the rest of the body unread,
+	// so the connection can't be used again.
+	if (c->j.req.scan && body.length() > before
+		&& c->j.req.scan(body.data() + before, body.length() - before))
+	{
+		c->keep_alive = false;
+		return 1;
+	}
+	return 0;
+}
+
+// Done with a request.
+void net_loop::finish(conn* c, http_resp resp)
+{
+	std::string host = c->host;
+	job j = std::move(c->j);
+
+	// Back to the pool if it's still good, else close it.
+	if (resp && c->keep_alive)
+	{
+		++c->served;
+		c->state = CONN_IDLE;
+		c->idle_since = clock::now();
+		c->in.clear();
+		c->resp = nullptr;
+		want(c, false);
+		pools[host].idle.push_back(c);
+	}
+	else
+	{
+		drop(c);
+	}
+
+	// Follow redirects on the same host. Anywhere else gets the
+	// redirect itself back.
+	std::string loc = resp ? resp->get_header_value("Location") : "";
+	if (j.req.follow_location && resp && resp->status >= 300 && resp->status < 400 && !loc.empty())
+	{
+		std::string origin = "https://" + host;
+		if (loc.compare(0, origin.length(), origin) == 0)
+		{
+			loc.erase(0, origin.length());
+			if (loc.empty()) { loc = "/"; }
+		}
+
+		if (loc[0] == '/' && j.redirects < COH_NET_LOOP_REDIRECTS)
+		{
+			j.req.path = loc;
+			++j.redirects;
+			pools[host].waiting.push_front(std::move(j));
+			dispatch(host);
+			return;
+		}
+	}
+
+	complete(j, resp);
+	dispatch(host);
+}
+
+// Hand back a result.
+void net_loop::complete(job& j, http_resp resp)
+{
+	--n_jobs;
+	done.emplace_back(std::move(j.on_done), resp);
+}
+
+// Close a connection.
+void net_loop::drop(conn* c)
+{
+	host_pool& p = pools[c->host];
+	auto it = std::find(p.idle.begin(), p.idle.end(), c);
+	if (it != p.idle.end())
+	{
+		p.idle.erase(it);
+	}
+	--p.open;
+
+	epoll_ctl(epfd, EPOLL_CTL_DEL, c->fd, nullptr);
+	if (c->ssl) { SSL_free(c->ssl); }
+	close(c->fd);
+	conns.erase(c->fd);
+	delete c;
+}
+
+// Look up a host.
+const std::vector<sockaddr_storage>* net_loop::resolve(const std::string& host)
+{
+	auto it = addrs.find(host);
+	if (it != addrs.end())
+	{
+		return &it->second;
+	}
+
+	addrinfo hints;
+	memset(&hints, 0, sizeof(hints));
+	hints.ai_family = AF_UNSPEC;
+	hints.ai_socktype = SOCK_STREAM;
+
+	addrinfo* res;
+	int r = getaddrinfo(host.c_str(), std::to_string(COH_PORT_HTTPS).c_str(), &hints, &res);
+	if (r != 0)
+	{
+		LOG_ERROR("Couldn't look up '%s': %s", host.c_str(), gai_strerror(r));
+		return nullptr;
+	}
+
+	std::vector<sockaddr_storage> v;
+	for (addrinfo* i = res; i; i = i->ai_next)
+	{
+		sockaddr_storage sa;
+		memset(&sa, 0, sizeof(sa));
+		memcpy(&sa, i->ai_addr, i->ai_addrlen);
+		v.push_back(sa);
+	}
+	freeaddrinfo(res);
+	if (v.empty())
+	{
+		return nullptr;
+	}
+	return &(addrs[host] = v);
+}
+
+// How long epoll may sleep.
+int net_loop::next_wake(void) const
+{
+	clock::time_point t = clock::time_point::max();
+	if (!timers.empty())
+	{
+		t = timers.begin()->first;
+	}
+	for (auto& i : conns)
+	{
+		const conn* c = i.second;
+		t = std::min(t, c->state == CONN_IDLE
+			? c->idle_since + std::chrono::milliseconds(COH_NET_POOL_IDLE_MS)
+			: c->j.deadline);
+	}
+	for (auto& i : pools)
+	{
+		for (auto& j : i.second.waiting)
+		{
+			t = std::min(t, j.deadline);
+		}
+	}
+	if (t == clock::time_point::max())
+	{
+		return -1;
+	}
+
+	// Round up so we don't wake just before it's due.
+	auto ms = std::chrono::duration_cast<std::chrono::milliseconds>(t - clock::now()).count() + 1;
+	return (int)std::max(0l, std::min((long)ms, (long)INT_MAX));
+}
+
+// Whether a request can safely be sent twice.
+bool net_loop::is_idempotent(const char* method)
+{
+	return strcmp(method, "GET") == 0 || strcmp(method, "HEAD") == 0;
+}
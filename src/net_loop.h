@@ -0,0 +1,192 @@
+#ifndef COH_NET_LOOP_H
+#define COH_NET_LOOP_H
+
+/*
+ * net_loop.h
+ * - A single-threaded HTTPS client on non-blocking sockets and epoll.
+ *   One thread can have hundreds of requests in flight at once.
+ * - Connections are pooled by host. Each host (each school) gets at
+ *   most COH_NET_POOL_PER_HOST of them, and requests beyond that
+ *   wait their turn in the order they came in, whichever account
+ *   they're for. A connection is kept alive and handed to the next
+ *   request for its host, and closed once it has sat idle for
+ *   COH_NET_POOL_IDLE_MS.
+ * - Follows same-host redirects when the request asks it to.
+ * - Completions and timers run on the loop's thread, after each batch
+ *   of events, so they may submit more requests.
+ * - Name lookups block, but are cached per host, so only the first
+ *   connection to a host pays for one.
+ */
+
+#include "net_client.h"
+
+class net_loop
+{
+public:
+	typedef std::function<void(http_resp)> on_done_fn;
+
+	net_loop();
+	~net_loop();
+
+	// Whether the TLS context could be set up. Nothing works if not.
+	bool is_ready(void) const;
+
+	// Send a request to a host. The callback gets the response, or
+	// null if the request failed or ran out of time. (Time spent
+	// waiting for a connection counts.)
+	void submit(const std::string&, const net_request&, unsigned long timeout_ms, on_done_fn);
+
+	// Call a function after some milliseconds.
+	void after(unsigned long ms, std::function<void(void)>);
+
+	// Run until there are no requests or timers left. Idle
+	// connections don't keep it running.
+	void run(void);
+
+	// Response body bytes so far, as they came off the wire and
+	// once decoded.
+	inline uint64_t bytes_wire_get(void) const
+	{
+		return bytes_wire;
+	}
+	inline uint64_t bytes_decoded_get(void) const
+	{
+		return bytes_decoded;
+	}
+
+private:
+	typedef std::chrono::steady_clock clock;
+
+	// What a connection is doing.
+	enum conn_state : char
+	{
+		CONN_CONNECTING = 0,
+		CONN_HANDSHAKE  = 1,
+		CONN_WRITING    = 2,
+		CONN_READING    = 3,
+		CONN_IDLE       = 4  // In the pool, waiting for a request.
+	};
+
+	// A request, waiting for or on a connection.
+	struct job
+	{
+		net_request req;
+		unsigned redirects;
+		clock::time_point deadline;
+		on_done_fn on_done;
+	};
+
+	// One connection.
+	struct conn
+	{
+		int fd;
+		SSL* ssl;
+		conn_state state;
+		std::string host;
+		unsigned addr;     // Which of the host's addresses.
+		unsigned served;   // Responses read off it so far.
+		clock::time_point idle_since;
+
+		// The request on it. (Not while idle.)
+		job j;
+
+		// Request bytes, and how many we've written.
+		std::string out;
+		size_t out_pos;
+
+		// Everything read so far. Once the head is parsed, resp
+		// holds the status and headers, and the body is decoded
+		// into it as it comes in.
+		std::string in;
+		http_resp resp;
+		size_t body_pos;   // Where the (undecoded) body starts in 'in'.
+		size_t take_pos;   // How much of an unchunked body was taken.
+		long content_len;  // -1 if not given.
+		bool chunked;
+		bool keep_alive;   // Whether it can be used again after this.
+
+		// Inflates a gzip or deflate body. Null if it isn't one.
+		std::unique_ptr<httplib::detail::decompressor> inflate;
+	};
+
+	// Everything we have for a host.
+	struct host_pool
+	{
+		unsigned open;           // Connections, idle or not.
+		std::vector<conn*> idle; // Most recently used last.
+		std::deque<job> waiting;
+	};
+
+	int epfd;
+	SSL_CTX* ssl_ctx;
+
+	// Connections by socket, and pools by host.
+	std::unordered_map<int, conn*> conns;
+	std::unordered_map<std::string, host_pool> pools;
+
+	// Requests that are waiting or on a connection.
+	unsigned n_jobs;
+
+	// Pending timers, soonest first.
+	std::multimap<clock::time_point, std::function<void(void)>> timers;
+
+	// Finished requests, waiting to be handed back.
+	std::vector<std::pair<on_done_fn, http_resp>> done;
+
+	// Looked-up addresses by host.
+	std::unordered_map<std::string, std::vector<sockaddr_storage>> addrs;
+
+	// Response body bytes, as they came off the wire and decoded.
+	uint64_t bytes_wire;
+	uint64_t bytes_decoded;
+
+private:
+	// Start whatever requests the host's pool has room for.
+	void dispatch(const std::string&);
+
+	// Open a new connection to one of a host's addresses.
+	// Returns null if it failed outright.
+	conn* open(const std::string&, unsigned);
+
+	// Put a request on a connected (or connecting) connection.
+	void assign(conn*, job&&);
+
+	// Couldn't connect. Try the host's next address, if it has one.
+	void connect_failed(conn*, int);
+
+	// Move a connection along as far as it will go without blocking.
+	void step(conn*);
+
+	// Wait for the socket to be readable or writable.
+	void want(conn*, bool);
+
+	// Parse what we've read. Returns 1 when the response is complete,
+	// 0 if we need more, or -1 if it's malformed.
+	int parse(conn*, bool eof);
+
+	// Take a piece of the body: count it, decode it, and scan it.
+	// Returns 0 to carry on, 1 if the scan has what it wants, or
+	// -1 if it won't decode.
+	int take(conn*, const char*, size_t);
+
+	// Done with the request on a connection, with a response or null.
+	// The connection goes back to the pool if it can.
+	void finish(conn*, http_resp);
+
+	// Hand back a request's result.
+	void complete(job&, http_resp);
+
+	// Close a connection for good.
+	void drop(conn*);
+
+	// Look up a host, from the cache if we can.
+	const std::vector<sockaddr_storage>* resolve(const std::string&);
+
+	// Milliseconds until the next timer or deadline, or -1.
+	int next_wake(void) const;
+
+	// Whether a request can safely be sent twice.
+	static bool is_idempotent(const char*);
+};
+
+#endif
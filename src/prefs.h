@@ -15,6 +15,13 @@ struct prefs
 	std::string path_tt;
 	std::string path_logoff;
 
+	// Optional command run by --watch when the timetable changes.
+	std::string watch_hook;
+
+	// Optional command that prints the username and password, one
+	// per line, so an expired session can be replaced without asking.
+	std::string cred_helper;
+
 	// Aliases for title strings.
 	std::unordered_map<std::string, std::string> aliases;
 };
@@ -0,0 +1,63 @@
+#ifndef COH_REQUEST_CTX_H
+#define COH_REQUEST_CTX_H
+
+/*
+ * request_ctx.h
+ * - Passed to every net_client operation.
+ * - The deadline bounds how long the whole operation (retries
+ *   included) may take, and the cancel token lets another thread
+ *   abort it. Both are checked as each chunk of a response arrives,
+ *   so a transfer in flight stops promptly.
+ * - Bytes received are reported to the progress callback.
+ */
+
+struct request_ctx
+{
+	typedef std::chrono::steady_clock clock;
+
+	// Give up once we pass this.
+	clock::time_point deadline;
+
+	// Set this (from any thread) to abort. May be null.
+	const std::atomic<bool>* cancel;
+
+	// Called as response bytes arrive, with (received, total).
+	// Total is 0 if the server didn't say. May be null.
+	void(*on_progress)(uint64_t, uint64_t);
+
+	request_ctx(unsigned timeout_ms,
+		const std::atomic<bool>* c=nullptr,
+		void(*cb_prog)(uint64_t, uint64_t)=nullptr)
+		: deadline(clock::now() + std::chrono::milliseconds(timeout_ms)),
+		cancel(c), on_progress(cb_prog)
+	{}
+
+	inline bool cancelled(void) const
+	{
+		return cancel && cancel->load();
+	}
+
+	inline bool expired(void) const
+	{
+		return clock::now() >= deadline;
+	}
+
+	// Whether whoever is doing the work should stop now.
+	inline bool should_stop(void) const
+	{
+		return cancelled() || expired();
+	}
+
+	// Milliseconds left until the deadline.
+	inline unsigned remaining_ms(void) const
+	{
+		clock::time_point now = clock::now();
+		if (now >= deadline)
+		{
+			return 0;
+		}
+		return (unsigned)std::chrono::duration_cast<std::chrono::milliseconds>(deadline - now).count();
+	}
+};
+
+#endif
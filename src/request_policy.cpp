@@ -0,0 +1,303 @@
+
+/*
+ * request_policy.cpp
+ * Implementations of request_policy.h methods.
+ */
+
+#include "pch.h"
+#include "request_policy.h"
+
+// Constructor. Start with a full bucket and a closed breaker.
+request_policy::request_policy(double r, unsigned b)
+	: rate(r), burst(b), tokens(b), tokens_last(clock::now()),
+	blocked_until(clock::now()), brk(BRK_CLOSED), brk_failures(0),
+	brk_until(clock::now()), brk_trial(false)
+{}
+
+// Send a request, retrying if it's worth it.
+http_resp request_policy::send(const std::function<http_resp(void)>& fn, const char* what,
+	bool retryable, const request_ctx& ctx)
+{
+	http_resp resp;
+	for (unsigned attempt = 0; ; ++attempt)
+	{
+		if (!breaker_allow())
+		{
+			LOG_WARN("Circuit breaker open. Not sending %s.", what);
+			return resp;
+		}
+		if (!acquire(ctx))
+		{
+			breaker_release();
+			break;
+		}
+		resp = fn();
+
+		// Cancelled or out of time mid-transfer. That isn't the
+		// server's fault, so the breaker doesn't hear about it.
+		if (!resp && ctx.should_stop())
+		{
+			breaker_release();
+			break;
+		}
+
+		long wait_ms = judge(resp, attempt, what, retryable);
+		if (wait_ms < 0)
+		{
+			return resp;
+		}
+
+		// No point waiting if we'd be out of time by then. Hand back
+		// what we got, so the caller sees the 5xx or 429.
+		if ((unsigned long)wait_ms >= ctx.remaining_ms())
+		{
+			LOG_WARN("%s: backoff exceeds deadline. Giving up.", what);
+			return resp;
+		}
+		if (!wait(std::chrono::milliseconds(wait_ms), ctx))
+		{
+			break;
+		}
+	}
+
+	LOG_WARN("%s: %s.", what, ctx.cancelled() ? "cancelled" : "deadline passed");
+	return nullptr;
+}
+
+// Get ready to send without blocking.
+long request_policy::try_acquire(void)
+{
+	if (!breaker_allow())
+	{
+		return -1;
+	}
+	clock::duration d;
+	if (!token_take(&d))
+	{
+		breaker_release();
+		return std::max(1l, (long)std::chrono::duration_cast<std::chrono::milliseconds>(d).count());
+	}
+	return 0;
+}
+
+// Look at how an attempt went.
+long request_policy::judge(const http_resp& resp, unsigned attempt, const char* what,
+	bool retryable)
+{
+	unsigned wait_ms;
+	if (!resp)
+	{
+		LOG_WARN("%s: no response (attempt %u).", what, attempt + 1);
+		breaker_record(false);
+		wait_ms = backoff_ms(attempt + 1);
+	}
+	else if (resp->status == 429)
+	{
+		// Being rate limited isn't the server failing, so the
+		// breaker doesn't count it. Hold off everyone instead.
+		int ra = retry_after(*resp);
+		if (ra > COH_NET_RETRY_AFTER_MAX)
+		{
+			LOG_WARN("%s: HTTP 429, Retry-After %d is too long. Giving up.", what, ra);
+			return -1;
+		}
+		wait_ms = ra >= 0 ? (unsigned)ra * 1000 : backoff_ms(attempt + 1);
+		LOG_WARN("%s: HTTP 429 (attempt %u), holding off %u ms.", what, attempt + 1, wait_ms);
+		{
+			std::lock_guard<std::mutex> lk(mtx);
+			blocked_until = std::max(blocked_until,
+				clock::now() + std::chrono::milliseconds(wait_ms));
+		}
+		breaker_record(true);
+	}
+	else if (resp->status >= 500)
+	{
+		LOG_WARN("%s: HTTP %d (attempt %u).", what, resp->status, attempt + 1);
+		breaker_record(false);
+		wait_ms = backoff_ms(attempt + 1);
+	}
+	else
+	{
+		// Anything else is the caller's problem.
+		breaker_record(true);
+		return -1;
+	}
+
+	// It may have been acted on, so it can't go again.
+	if (!retryable)
+	{
+		LOG_ERROR("%s: not safe to send again. Giving up.", what);
+		return -1;
+	}
+	if (attempt >= COH_NET_RETRIES)
+	{
+		LOG_ERROR("%s: giving up after %u attempts.", what, COH_NET_RETRIES + 1);
+		return -1;
+	}
+	return wait_ms;
+}
+
+// Whether the breaker lets a request through right now.
+bool request_policy::breaker_allow(void)
+{
+	std::lock_guard<std::mutex> lk(mtx);
+	switch (brk)
+	{
+		case (BRK_CLOSED): return true;
+
+		case (BRK_OPEN):
+		{
+			if (clock::now() < brk_until)
+			{
+				return false;
+			}
+			LOG_INFO("Circuit breaker half-open. Sending a trial request.");
+			brk = BRK_HALF_OPEN;
+			brk_trial = true;
+			return true;
+		}
+
+		case (BRK_HALF_OPEN):
+		{
+			// Only one trial at a time.
+			if (brk_trial)
+			{
+				return false;
+			}
+			brk_trial = true;
+			return true;
+		}
+	}
+	return true;
+}
+
+// Record the outcome of a request.
+void request_policy::breaker_record(bool ok)
+{
+	std::lock_guard<std::mutex> lk(mtx);
+	brk_trial = false;
+	if (ok)
+	{
+		if (brk != BRK_CLOSED)
+		{
+			LOG_INFO("Circuit breaker closed.");
+		}
+		brk = BRK_CLOSED;
+		brk_failures = 0;
+		return;
+	}
+
+	// A failed trial re-opens straight away.
+	if (brk == BRK_HALF_OPEN || ++brk_failures >= COH_NET_BREAKER_THRESHOLD)
+	{
+		if (brk != BRK_OPEN)
+		{
+			LOG_WARN("Circuit breaker open for %d seconds.", COH_NET_BREAKER_COOLDOWN);
+		}
+		brk = BRK_OPEN;
+		brk_until = clock::now() + std::chrono::seconds(COH_NET_BREAKER_COOLDOWN);
+	}
+}
+
+// Give back a half-open trial we didn't use.
+void request_policy::breaker_release(void)
+{
+	std::lock_guard<std::mutex> lk(mtx);
+	brk_trial = false;
+}
+
+// Take a token from the bucket, waiting for one if we need to.
+bool request_policy::acquire(const request_ctx& ctx)
+{
+	clock::duration d;
+	while (!token_take(&d))
+	{
+		if (!wait(d, ctx))
+		{
+			return false;
+		}
+	}
+	return !ctx.should_stop();
+}
+
+// Take a token if there is one. Otherwise say how long until there is.
+bool request_policy::token_take(clock::duration* d)
+{
+	std::lock_guard<std::mutex> lk(mtx);
+	clock::time_point now = clock::now();
+	if (now < blocked_until)
+	{
+		*d = blocked_until - now;
+		return false;
+	}
+
+	// Top up the bucket for the time that's passed.
+	std::chrono::duration<double> dt = now - tokens_last;
+	tokens = std::min((double)burst, tokens + dt.count() * rate);
+	tokens_last = now;
+	if (tokens >= 1.0)
+	{
+		tokens -= 1.0;
+		return true;
+	}
+	*d = std::chrono::duration_cast<clock::duration>(
+		std::chrono::duration<double>((1.0 - tokens) / rate));
+	return false;
+}
+
+// Sleep in short slices so cancellation is noticed quickly.
+bool request_policy::wait(clock::duration d, const request_ctx& ctx)
+{
+	clock::time_point until = clock::now() + d;
+	for (;;)
+	{
+		if (ctx.should_stop())
+		{
+			return false;
+		}
+		clock::time_point now = clock::now();
+		if (now >= until)
+		{
+			return true;
+		}
+		std::this_thread::sleep_for(std::min<clock::duration>(until - now,
+			std::chrono::milliseconds(COH_NET_WAIT_SLICE_MS)));
+	}
+}
+
+// Parse Retry-After. It is either a number of seconds or an HTTP date.
+int request_policy::retry_after(const httplib::Response& r)
+{
+	std::string v = r.get_header_value("Retry-After");
+	if (v.empty())
+	{
+		return -1;
+	}
+
+	char* end;
+	long secs = strtol(v.c_str(), &end, 10);
+	if (end != v.c_str() && *end == '\0')
+	{
+		return secs < 0 ? 0 : (int)std::min(secs, (long)INT_MAX);
+	}
+
+	std::tm t = {};
+	if (!strptime(v.c_str(), "%a, %d %b %Y %H:%M:%S", &t))
+	{
+		return -1;
+	}
+	long diff = (long)(timegm(&t) - std::time(0));
+	return diff < 0 ? 0 : (int)std::min(diff, (long)INT_MAX);
+}
+
+// Exponential backoff with jitter: a random wait between half and
+// all of base * 2^(retry - 1), capped.
+unsigned request_policy::backoff_ms(unsigned retry)
+{
+	static thread_local std::minstd_rand rng(
+		(unsigned)std::hash<std::thread::id>()(std::this_thread::get_id()) ^ (unsigned)std::time(0));
+
+	unsigned shift = std::min(retry - 1, 16u);
+	unsigned cap = std::min((unsigned)COH_NET_BACKOFF_BASE_MS << shift, (unsigned)COH_NET_BACKOFF_MAX_MS);
+	return cap / 2 + std::uniform_int_distribution<unsigned>(0, cap - cap / 2)(rng);
+}
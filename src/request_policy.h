@@ -0,0 +1,103 @@
+#ifndef COH_REQUEST_POLICY_H
+#define COH_REQUEST_POLICY_H
+
+/*
+ * request_policy.h
+ * - Wraps every request net_client makes to the host.
+ * - Retries transient failures (no response, or a 5xx) with
+ *   jittered exponential backoff, and honours 429 Retry-After.
+ *   Only for requests that are safe to send again, though. One that
+ *   may have been acted on (like posting credentials) is sent once.
+ * - A token bucket limits how many requests per second we send.
+ * - A circuit breaker stops all requests for a while after too many
+ *   failures in a row, so retries from many workers don't pile up
+ *   on a struggling server.
+ * - Safe to use from several threads at once.
+ * - Never waits past a request's deadline, and stops as soon as it
+ *   is cancelled.
+ */
+
+#include "request_ctx.h"
+
+typedef std::shared_ptr<httplib::Response> http_resp;
+
+class request_policy
+{
+public:
+	// Sends at most the given requests per second, with bursts of up
+	// to the given size.
+	request_policy(double rate=COH_NET_RATE_PER_SEC, unsigned burst=COH_NET_RATE_BURST);
+
+	// Send a request through the policy. The function is called once
+	// per attempt, or only once if the request isn't retryable.
+	// Returns the last response (null if we never got one, if the
+	// circuit breaker is open, or if the context stopped us).
+	http_resp send(const std::function<http_resp(void)>&, const char*, bool retryable,
+		const request_ctx&);
+
+	// The same policy in pieces, for event loops that can't block.
+	// try_acquire returns how long to wait before trying again, 0 if
+	// we may send now, or -1 if the circuit breaker is open.
+	// judge takes the response to an attempt (counting from 0) and
+	// returns how long to wait before retrying, or -1 if we shouldn't.
+	long try_acquire(void);
+	long judge(const http_resp&, unsigned, const char*, bool retryable);
+
+private:
+	// Breaker states.
+	enum breaker_state : char
+	{
+		BRK_CLOSED    = 0, // All good.
+		BRK_OPEN      = 1, // Refusing requests until the cooldown ends.
+		BRK_HALF_OPEN = 2  // Letting one trial request through.
+	};
+
+	typedef std::chrono::steady_clock clock;
+
+	// Guards everything below.
+	std::mutex mtx;
+
+	// Token bucket.
+	const double rate;
+	const unsigned burst;
+	double tokens;
+	clock::time_point tokens_last;
+
+	// Set by a 429. Nobody sends before this.
+	clock::time_point blocked_until;
+
+	// Circuit breaker.
+	breaker_state brk;
+	unsigned brk_failures;      // Consecutive failures.
+	clock::time_point brk_until; // When an open breaker goes half-open.
+	bool brk_trial;             // A half-open trial is in flight.
+
+private:
+	// Whether the breaker lets a request through.
+	bool breaker_allow(void);
+
+	// Tell the breaker how a request went.
+	void breaker_record(bool);
+
+	// Tell the breaker a request was abandoned without an outcome.
+	void breaker_release(void);
+
+	// Block until we may send. Returns false if the context
+	// stopped us first.
+	bool acquire(const request_ctx&);
+
+	// Take a token, or get how long until there is one.
+	bool token_take(clock::duration*);
+
+	// Sleep, waking early if the context stops us.
+	// Returns false if it did.
+	static bool wait(clock::duration, const request_ctx&);
+
+	// Get the Retry-After of a response in seconds, or -1.
+	static int retry_after(const httplib::Response&);
+
+	// Backoff before the given retry (starting at 1), with jitter.
+	static unsigned backoff_ms(unsigned);
+};
+
+#endif
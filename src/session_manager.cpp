@@ -0,0 +1,195 @@
+
+/*
+ * session_manager.cpp
+ * Implementations of session_manager.h methods.
+ */
+
+#include "pch.h"
+#include "datetime.h"
+#include "net_client.h"
+#include "session_manager.h"
+
+// Constructor.
+session_manager::session_manager(net_client* const c, const std::string& h)
+	: client(c), helper(h), stopping(false)
+{}
+
+// Stop the thread, and whatever it's doing.
+session_manager::~session_manager()
+{
+	{
+		std::lock_guard<std::mutex> lk(mtx);
+		stopping = true;
+	}
+	cv.notify_all();
+	if (thr.joinable())
+	{
+		thr.join();
+	}
+}
+
+// Start checking.
+void session_manager::start(void)
+{
+	LOG_INFO("Keeping the session warm. Credential helper: %s",
+		has_helper() ? "yes" : "no");
+	thr = std::thread(&session_manager::run, this);
+}
+
+// Log in again with the helper's credentials.
+bool session_manager::relogin(void)
+{
+	std::lock_guard<std::mutex> lk(login_mtx);
+
+	std::string user, pass;
+	if (!credentials(user, pass))
+	{
+		return false;
+	}
+
+	LOG_INFO("Logging in again in the background...");
+	bool ok = client->login(user, pass,
+		request_ctx(COH_NET_DEADLINE_LOGIN_MS, &stopping));
+	if (!ok)
+	{
+		LOG_WARN("Background login failed.");
+	}
+	return ok;
+}
+
+// Log in again on the background thread.
+void session_manager::relogin_later(std::function<void(bool)> cb)
+{
+	{
+		std::lock_guard<std::mutex> lk(mtx);
+		relogin_cb = std::move(cb);
+	}
+	cv.notify_all();
+}
+
+// The background thread. Checks the session when it's due, and
+// logs in when asked to in between.
+void session_manager::run(void)
+{
+	typedef std::chrono::steady_clock clock;
+	clock::time_point next = clock::now();
+
+	std::unique_lock<std::mutex> lk(mtx);
+	while (!stopping)
+	{
+		if (relogin_cb)
+		{
+			std::function<void(bool)> cb = std::move(relogin_cb);
+			relogin_cb = nullptr;
+			lk.unlock();
+			bool ok = relogin();
+			cb(ok);
+			lk.lock();
+			continue;
+		}
+
+		if (clock::now() >= next)
+		{
+			lk.unlock();
+			unsigned wait = check();
+			lk.lock();
+
+			LOG_DBUG("Next session check in %u seconds.", wait);
+			next = clock::now() + std::chrono::seconds(wait);
+			continue;
+		}
+
+		cv.wait_until(lk, next, [this]() { return stopping.load() || (bool)relogin_cb; });
+	}
+}
+
+// Check the session once.
+unsigned session_manager::check(void)
+{
+	// Seconds until the session expires, if its cookies say.
+	datetime exp;
+	auto left = [&](long& secs)
+	{
+		if (!client->session_expiry(exp))
+		{
+			return false;
+		}
+		secs = (long)(exp.time_utc - std::time(0));
+		return true;
+	};
+
+	// Log in again if it's gone, or nearly gone. Otherwise ask the site
+	// how it is, as session cookies last as long as it says they do.
+	long secs = 0;
+	bool expires = left(secs);
+	bool stale = false;
+	if (!client->session_exists())
+	{
+		stale = true;
+	}
+	else if (expires && secs <= COH_SESSION_REFRESH_SECS)
+	{
+		LOG_INFO("Session expires in %ld seconds. Refreshing it.", secs);
+		stale = true;
+	}
+	else
+	{
+		stale = client->probe(request_ctx(COH_NET_DEADLINE_LOGIN_MS, &stopping)) == SESSION_EXPIRED;
+	}
+
+	if (stale && has_helper() && !stopping && relogin())
+	{
+		expires = left(secs);
+	}
+
+	// Check again in time to refresh before it expires, but not so
+	// soon that a login that keeps failing spins.
+	long wait = COH_SESSION_PROBE_SECS;
+	if (expires && secs - COH_SESSION_REFRESH_SECS < wait)
+	{
+		wait = secs - COH_SESSION_REFRESH_SECS;
+	}
+	return (unsigned)std::max(wait, (long)COH_SESSION_RETRY_SECS);
+}
+
+// Run the helper. It prints the username, then the password.
+bool session_manager::credentials(std::string& user, std::string& pass) const
+{
+	if (!has_helper())
+	{
+		return false;
+	}
+
+	FILE* p = popen(helper.c_str(), "r");
+	if (!p)
+	{
+		LOG_ERROR("Couldn't run the credential helper: %s", strerror(errno));
+		return false;
+	}
+
+	// Read a line, without its newline.
+	char buf[256];
+	auto line = [&](std::string& out)
+	{
+		if (!fgets(buf, sizeof(buf), p))
+		{
+			return false;
+		}
+		out = buf;
+		while (!out.empty() && (out.back() == '\n' || out.back() == '\r'))
+		{
+			out.pop_back();
+		}
+		return !out.empty();
+	};
+	bool ok = line(user) && line(pass);
+	int status = pclose(p);
+
+	// Don't log what it printed. It's the password.
+	if (!ok || status != 0)
+	{
+		LOG_ERROR("Credential helper failed (exit status %d).", status);
+		return false;
+	}
+	return true;
+}
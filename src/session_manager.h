@@ -0,0 +1,76 @@
+#ifndef COH_SESSION_MANAGER_H
+#define COH_SESSION_MANAGER_H
+
+/*
+ * session_manager.h
+ * - Keeps a client's session warm in the background, so a fetch
+ *   doesn't find out the session died and stop to log in.
+ * - Every COH_SESSION_PROBE_SECS it asks the site whether the
+ *   session is still good. (See net_client::probe)
+ * - Logs in again COH_SESSION_REFRESH_SECS before the first cookie
+ *   expires, or as soon as a probe finds the session dead, with the
+ *   credentials the cred_helper command prints. The new session is
+ *   swapped in once it's complete, so fetches never wait on it.
+ * - Without a helper it can only keep the login status honest, and
+ *   the user is asked for credentials as before.
+ */
+
+class net_client;
+
+class session_manager
+{
+public:
+	session_manager(net_client* const, const std::string&);
+	~session_manager();
+
+	// Start checking in the background.
+	void start(void);
+
+	// Log in again now with the helper's credentials. Blocks.
+	// Returns false if there's no helper or logging in failed.
+	bool relogin(void);
+
+	// Log in again on the background thread, and call back from
+	// it with whether it worked. (Not called if we stop first.)
+	void relogin_later(std::function<void(bool)>);
+
+	// Whether we have a credential helper to log in with.
+	inline bool has_helper(void) const
+	{
+		return !helper.empty();
+	}
+
+private:
+	// The client whose session we look after.
+	net_client* client;
+
+	// Command that prints the username and password.
+	std::string helper;
+
+	// The background thread, and what wakes it to stop.
+	// (Stopping also cancels a probe or login in flight.)
+	std::thread thr;
+	std::mutex mtx;
+	std::condition_variable cv;
+	std::atomic<bool> stopping;
+
+	// Called when a login asked for with relogin_later is done.
+	// Empty if none was asked for.
+	std::function<void(bool)> relogin_cb;
+
+	// Only one login at a time, whoever asks for it.
+	std::mutex login_mtx;
+
+private:
+	// The background thread.
+	void run(void);
+
+	// Check the session once, logging in again if we must.
+	// Returns seconds until the next check.
+	unsigned check(void);
+
+	// Run the helper for credentials.
+	bool credentials(std::string&, std::string&) const;
+};
+
+#endif
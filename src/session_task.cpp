@@ -0,0 +1,202 @@
+
+/*
+ * session_task.cpp
+ * Implementations of session_task.h methods.
+ */
+
+#include "pch.h"
+#include "application.h"
+#include "net_loop.h"
+#include "session_task.h"
+
+// Constructor.
+session_task::session_task(net_loop& l, application& a, net_client& c,
+	const std::string& user, const std::string& pass)
+	: error(nullptr), days_ok(0), days_failed(0), days_changed(0), login_ms(0), fetch_ms(0),
+	loop(l), app(a), client(c), username(user), password(pass),
+	state(TASK_DONE), step(LOGIN_GET_PAGE), day(0), attempt(0), relogged(false), days(0),
+	ctx(COH_NET_DEADLINE_LOGIN_MS)
+{}
+
+// Get going.
+void session_task::start(const datetime_dmy& f, unsigned d, std::function<void(void)> cb)
+{
+	from = f;
+	days = d;
+	on_finished = std::move(cb);
+	started = clock::now();
+	attempt = 0;
+	day = 0;
+
+	// Only log in if we don't have a saved session.
+	if (!client.session_exists())
+	{
+		login();
+		return;
+	}
+	if (days == 0)
+	{
+		finish(nullptr);
+		return;
+	}
+	state = TASK_FETCH;
+	ctx = request_ctx(COH_NET_DEADLINE_RETRIEVE_MS);
+	send();
+}
+
+// Start logging in.
+void session_task::login(void)
+{
+	LOG_INFO("Logging in with username '%s'...", username.c_str());
+	state = TASK_LOGIN;
+	step = LOGIN_GET_PAGE;
+	attempt = 0;
+	login_started = clock::now();
+	ctx = request_ctx(COH_NET_DEADLINE_LOGIN_MS);
+	send();
+}
+
+// Send the current request.
+void session_task::send(void)
+{
+	// Build the request fresh each attempt. The cookies may
+	// have changed since the last step.
+	if (state == TASK_LOGIN)
+	{
+		req = client.login_request(step, username, password);
+	}
+	else
+	{
+		datetime_dmy d = application::date_add(from, day);
+		cur = tt_day();
+		cur.fingerprint = app.cached_fingerprint(d);
+		req = client.retrieve_request(d);
+	}
+
+	long wait_ms = client.policy_get().try_acquire();
+	if (wait_ms < 0)
+	{
+		LOG_WARN("%s: circuit breaker is open. Not sending.", req.what);
+		advance(false);
+		return;
+	}
+	if (wait_ms > 0)
+	{
+		if ((unsigned long)wait_ms >= ctx.remaining_ms())
+		{
+			LOG_WARN("%s: out of time waiting to send.", req.what);
+			advance(false);
+			return;
+		}
+		loop.after(wait_ms, [this]() { send(); });
+		return;
+	}
+
+	loop.submit(client.get_hostname(), req, ctx.remaining_ms(),
+		[this](http_resp resp) { on_response(resp); });
+}
+
+// Handle a response.
+void session_task::on_response(http_resp resp)
+{
+	// Try again if the policy says so and we have the time.
+	long wait_ms = client.policy_get().judge(resp, attempt, req.what, req.retryable);
+	if (wait_ms >= 0)
+	{
+		if ((unsigned long)wait_ms < ctx.remaining_ms())
+		{
+			++attempt;
+			loop.after(wait_ms, [this]() { send(); });
+			return;
+		}
+		LOG_WARN("%s: out of time to retry.", req.what);
+	}
+
+	if (state == TASK_LOGIN)
+	{
+		advance(client.login_response(step, resp, username));
+		return;
+	}
+
+	// The saved session has died. Log in again, once, and then
+	// try this day again.
+	if (!relogged && net_client::session_lost(resp))
+	{
+		LOG_WARN("Session for '%s' has expired.", username.c_str());
+		relogged = true;
+		login();
+		return;
+	}
+
+	// Take in the day through the application, like a blocking fetch.
+	datetime_dmy d = application::date_add(from, day);
+	bool unchanged = false, changed = false;
+	tt_day outp;
+	bool ok = client.retrieve_response(resp, cur.periods, cur.events, d, app.get_prefs(),
+			cur.fingerprint, unchanged)
+		&& app.day_retrieved(outp, d, cur, unchanged, &changed);
+	if (ok && changed)
+	{
+		++days_changed;
+	}
+	advance(ok);
+}
+
+// Move on.
+void session_task::advance(bool ok)
+{
+	attempt = 0;
+	if (state == TASK_LOGIN)
+	{
+		if (!ok)
+		{
+			finish("login failed");
+			return;
+		}
+
+		step = (login_step)(step + 1);
+		if (step == LOGIN_DONE)
+		{
+			// On to the days, from wherever we were.
+			login_ms += std::chrono::duration_cast<std::chrono::milliseconds>(
+				clock::now() - login_started).count();
+			state = TASK_FETCH;
+			ctx = request_ctx(COH_NET_DEADLINE_RETRIEVE_MS);
+			if (day == days)
+			{
+				finish(nullptr);
+				return;
+			}
+		}
+		send();
+		return;
+	}
+
+	// A failed day doesn't stop the others.
+	if (ok) { ++days_ok; }
+	else    { ++days_failed; }
+
+	if (++day == days)
+	{
+		finish(days_failed ? "some days failed" : nullptr);
+		return;
+	}
+	ctx = request_ctx(COH_NET_DEADLINE_RETRIEVE_MS);
+	send();
+}
+
+// All done.
+void session_task::finish(const char* err)
+{
+	error = err;
+	unsigned long ms = std::chrono::duration_cast<std::chrono::milliseconds>(
+		clock::now() - started).count();
+	if (state == TASK_LOGIN)
+	{
+		login_ms += std::chrono::duration_cast<std::chrono::milliseconds>(
+			clock::now() - login_started).count();
+	}
+	fetch_ms = ms - login_ms;
+	state = TASK_DONE;
+	on_finished();
+}
@@ -0,0 +1,100 @@
+#ifndef COH_SESSION_TASK_H
+#define COH_SESSION_TASK_H
+
+/*
+ * session_task.h
+ * - Logs one account in and fetches a range of days, as a state
+ *   machine on a net_loop rather than a thread blocking on each
+ *   request. Each response moves it on to its next request.
+ * - Uses the same steps as net_client::login and retrieve_data, and
+ *   the same request_policy, through its non-blocking half. Waits
+ *   for tokens, backoff and Retry-After become loop timers.
+ * - Days are taken in one at a time through application, so they
+ *   are cached and diffed just like a blocking fetch.
+ * - A saved session the site has since killed is found out by the
+ *   first day sent to the login page. We log in once with the
+ *   manifest's password and carry on from that day.
+ */
+
+#include "datetime.h"
+#include "datetime_dmy.h"
+#include "net_client.h"
+#include "request_ctx.h"
+#include "tt_period.h"
+#include "tt_day.h"
+
+class application;
+class net_loop;
+
+class session_task
+{
+public:
+	session_task(net_loop&, application&, net_client&,
+		const std::string&, const std::string&);
+
+	// Log in if we need to, then fetch the days starting at the date.
+	// The callback is called (on the loop's thread) once we're done.
+	// It mustn't destroy the task itself. Defer that with net_loop::after.
+	void start(const datetime_dmy&, unsigned, std::function<void(void)>);
+
+	// How it went. Valid once finished.
+	const char* error;      // Why it failed. Null if it didn't.
+	unsigned days_ok;
+	unsigned days_failed;
+	unsigned days_changed;
+	unsigned long login_ms; // Zero if we re-used a session that held.
+	unsigned long fetch_ms;
+
+private:
+	typedef std::chrono::steady_clock clock;
+
+	// Where we're up to.
+	enum task_state : char
+	{
+		TASK_LOGIN = 0,
+		TASK_FETCH = 1,
+		TASK_DONE  = 2
+	};
+
+	net_loop& loop;
+	application& app;
+	net_client& client;
+	std::string username;
+	std::string password;
+
+	task_state state;
+	login_step step;  // While logging in.
+	unsigned day;     // While fetching, days from 'from'.
+	unsigned attempt; // Of the current request, counting from 0.
+	bool relogged;    // Whether we logged in again mid-fetch.
+
+	datetime_dmy from;
+	unsigned days;
+
+	// The request in flight, the day it's for, and its deadline.
+	net_request req;
+	tt_day cur;
+	request_ctx ctx;
+
+	clock::time_point started;
+	clock::time_point login_started;
+	std::function<void(void)> on_finished;
+
+private:
+	// Send the current request, once the policy lets us.
+	void send(void);
+
+	// Handle its response.
+	void on_response(http_resp);
+
+	// Move on to the next request, or finish.
+	void advance(bool ok);
+
+	// Start logging in.
+	void login(void);
+
+	// Finish, with an error or null.
+	void finish(const char*);
+};
+
+#endif
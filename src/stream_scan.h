@@ -0,0 +1,99 @@
+#ifndef COH_STREAM_SCAN_H
+#define COH_STREAM_SCAN_H
+
+/*
+ * stream_scan.h
+ * - Looks for a marker followed by a value and a terminator (like
+ *   'Compass.organisationUserId = 1234;') in a body that arrives in
+ *   pieces, so we can stop reading as soon as we've seen it.
+ * - The marker and value may be split across any number of pieces.
+ *   Only the last few bytes of each piece are kept, so it never
+ *   holds more than the marker plus the value.
+ */
+
+class stream_scan
+{
+public:
+	// The value may be at most max_len long. A longer one isn't it,
+	// and we carry on looking.
+	stream_scan(const char* m, char t, size_t max_len)
+		: marker(m), term(t), value_max(max_len), in_value(false), is_found(false)
+	{}
+
+	// Scan the next piece. Returns true once the value and its
+	// terminator have been seen.
+	bool feed(const char* buf, size_t n)
+	{
+		while (n && !is_found)
+		{
+			if (!in_value)
+			{
+				// Look for the marker in what's left of the last
+				// piece and this one. Whatever comes after it is
+				// the start of the value.
+				size_t old = tail.length();
+				tail.append(buf, n);
+				size_t i = tail.find(marker);
+				if (i == std::string::npos)
+				{
+					// Keep just enough to catch a marker split
+					// between this piece and the next.
+					if (tail.length() >= marker.length())
+					{
+						tail.erase(0, tail.length() - marker.length() + 1);
+					}
+					return false;
+				}
+
+				size_t used = i + marker.length() - old;
+				buf += used;
+				n -= used;
+				tail.clear();
+				val.clear();
+				in_value = true;
+				continue;
+			}
+
+			// Take the value up to its terminator.
+			const char* t = (const char*)memchr(buf, term, n);
+			size_t take = t ? (size_t)(t - buf) : n;
+			val.append(buf, take);
+			buf += take;
+			n -= take;
+			if (val.length() > value_max)
+			{
+				in_value = false;
+				val.clear();
+				continue;
+			}
+			is_found = !!t;
+		}
+		return is_found;
+	}
+
+	inline bool found(void) const
+	{
+		return is_found;
+	}
+
+	// The value, once found.
+	inline const std::string& value(void) const
+	{
+		return val;
+	}
+
+private:
+	std::string marker;
+	char term;
+	size_t value_max;
+
+	// End of the last piece, in case it holds the start of the marker.
+	std::string tail;
+
+	// The value so far.
+	std::string val;
+	bool in_value;
+	bool is_found;
+};
+
+#endif
@@ -0,0 +1,301 @@
+
+/*
+ * sync_engine.cpp
+ * Implementations of sync_engine.h methods.
+ */
+
+#include "pch.h"
+#include "application.h"
+#include "datetime.h"
+#include "datetime_dmy.h"
+#include "net_client.h"
+#include "net_loop.h"
+#include "session_task.h"
+#include "sync_engine.h"
+#include "tt_day.h"
+#include "tt_period.h"
+
+typedef std::chrono::steady_clock sync_clock;
+
+// Milliseconds since a point in time.
+static inline unsigned long ms_since(const sync_clock::time_point& t)
+{
+	return (unsigned long)std::chrono::duration_cast<std::chrono::milliseconds>(
+		sync_clock::now() - t).count();
+}
+
+// Make a username safe to use as a directory name.
+static std::string safe_name(const std::string& s)
+{
+	std::string ret = s;
+	for (unsigned i = 0; i < ret.length(); ++i)
+	{
+		char c = ret[i];
+		if (!isalnum((unsigned char)c) && c != '.' && c != '-' && c != '_')
+		{
+			ret[i] = '_';
+		}
+	}
+	if (ret.empty() || ret[0] == '.')
+	{
+		ret.insert(0, "_");
+	}
+	return ret;
+}
+
+// Constructor.
+sync_engine::sync_engine(const datetime_dmy& f, unsigned d, unsigned j)
+	: loop(nullptr), next(0), from(f), days(d), jobs(j)
+{}
+
+// Destructor.
+sync_engine::~sync_engine()
+{}
+
+// Read the manifest. Each line is:
+//   username password [prefs file]
+// Blank lines and lines starting with # are skipped.
+bool sync_engine::load_manifest(const std::string& path)
+{
+	std::ifstream f(path);
+	if (!f.good())
+	{
+		fprintf(stderr, "Couldn't open manifest '%s'.\n", path.c_str());
+		return false;
+	}
+
+	std::unordered_set<std::string> names;
+	size_t cur_line = 1;
+	for (std::string line; std::getline(f, line); ++cur_line)
+	{
+		size_t first = line.find_first_not_of(" \t\r");
+		if (first == std::string::npos || line[first] == '#')
+		{
+			continue;
+		}
+
+		sync_account a;
+		std::istringstream ss(line);
+		if (!(ss >> a.username >> a.password))
+		{
+			fprintf(stderr, "Manifest, line %u: expected a username and password.\n", (unsigned)cur_line);
+			return false;
+		}
+		if (!(ss >> a.prefs_path))
+		{
+			a.prefs_path = COH_PREFS_FILE_PATH;
+		}
+
+		// Two usernames could come out the same once made safe.
+		a.name = safe_name(a.username);
+		if (!names.insert(a.name).second)
+		{
+			fprintf(stderr, "Manifest, line %u: account '%s' is listed twice.\n",
+				(unsigned)cur_line, a.username.c_str());
+			return false;
+		}
+		accounts.push_back(a);
+	}
+
+	if (accounts.empty())
+	{
+		fprintf(stderr, "Manifest '%s' has no accounts.\n", path.c_str());
+		return false;
+	}
+	LOG_INFO("Read %u accounts from manifest.", accounts.size());
+	return true;
+}
+
+// Sync everything.
+int sync_engine::run(void)
+{
+	if (mkdir(COH_SYNC_DIR, 0777) != 0 && errno != EEXIST)
+	{
+		fprintf(stderr, "Couldn't create '%s'.\n", COH_SYNC_DIR);
+		return 1;
+	}
+
+	// A server hanging up on a pooled connection mid-write
+	// shouldn't take us down.
+	signal(SIGPIPE, SIG_IGN);
+
+	net_loop l;
+	if (!l.is_ready())
+	{
+		fprintf(stderr, "Couldn't set up the network loop. (Is '%s' there?)\n", COH_CA_CERT_PATH);
+		return 1;
+	}
+	loop = &l;
+
+	outcomes.assign(accounts.size(), sync_outcome());
+	running.clear();
+	running.resize(accounts.size());
+	unsigned n_at_once = std::max(1u, std::min(jobs, (unsigned)accounts.size()));
+	fprintf(stderr, "Syncing %u accounts, %u days from %04u-%02u-%02u, %u at once...\n",
+		(unsigned)accounts.size(), days, from.year, from.month, from.day, n_at_once);
+
+	sync_clock::time_point t0 = sync_clock::now();
+	for (unsigned i = 0; i < n_at_once; ++i)
+	{
+		start_next();
+	}
+	l.run();
+	loop = nullptr;
+
+	report(ms_since(t0), l.bytes_wire_get(), l.bytes_decoded_get());
+
+	for (unsigned i = 0; i < outcomes.size(); ++i)
+	{
+		if (outcomes[i].error)
+		{
+			return 1;
+		}
+	}
+	return 0;
+}
+
+// Start the next account that can be started.
+void sync_engine::start_next(void)
+{
+	while (next < accounts.size())
+	{
+		unsigned i = next++;
+		if (start_one(i))
+		{
+			return;
+		}
+	}
+}
+
+// Set up an account and start its task. Returns false if it
+// failed before getting that far.
+bool sync_engine::start_one(unsigned i)
+{
+	const sync_account& a = accounts[i];
+	sync_outcome& o = outcomes[i];
+	o = { nullptr, 0, 0, 0, 0, 0, 0 };
+	running_account& r = running[i];
+	r.t0 = sync_clock::now();
+
+	// Everything for this account lives in its own directory.
+	std::string dir = std::string(COH_SYNC_DIR) + a.name + "/";
+	if (mkdir(dir.c_str(), 0700) != 0 && errno != EEXIST)
+	{
+		account_done(i, "couldn't create account directory");
+		return false;
+	}
+
+	r.app.reset(new application(
+		[](const datetime_dmy&) {},
+		[](const fetch_result&) {},
+		dir + COH_SYNC_CACHE_NAME
+	));
+	if (!r.app->prefs_check(a.prefs_path))
+	{
+		account_done(i, "prefs file missing or invalid");
+		return false;
+	}
+
+	r.client.reset(new net_client(r.app->get_prefs(), [](int) {}, dir + COH_SYNC_JAR_NAME));
+	std::shared_ptr<request_policy>& pol = host_policies[r.client->get_hostname()];
+	if (!pol)
+	{
+		pol = std::make_shared<request_policy>(COH_NET_HOST_RATE, COH_NET_HOST_BURST);
+	}
+	r.client->policy_share(pol);
+	r.app->client_set(r.client.get());
+
+	r.task.reset(new session_task(*loop, *r.app, *r.client, a.username, a.password));
+	r.task->start(from, days, [this, i]()
+	{
+		const session_task& t = *running[i].task;
+		sync_outcome& o = outcomes[i];
+		o.days_ok      = t.days_ok;
+		o.days_failed  = t.days_failed;
+		o.days_changed = t.days_changed;
+		o.login_ms     = t.login_ms;
+		o.fetch_ms     = t.fetch_ms;
+		const char* err = t.error;
+
+		// We're inside the task, so it goes away once we're out.
+		loop->after(0, [this, i, err]()
+		{
+			account_done(i, err);
+			start_next();
+		});
+	});
+	return true;
+}
+
+// Finish up an account's outcome, log it and free it.
+void sync_engine::account_done(unsigned i, const char* err)
+{
+	const sync_account& a = accounts[i];
+	sync_outcome& o = outcomes[i];
+	running_account& r = running[i];
+
+	o.error = err;
+	o.total_ms = ms_since(r.t0);
+	if (err)
+	{
+		LOG_WARN("Sync '%s' failed: %s", a.username.c_str(), err);
+	}
+	else
+	{
+		LOG_INFO("Sync '%s' done in %lu ms.", a.username.c_str(), o.total_ms);
+	}
+
+	// The client goes before the application that points to it.
+	r.task.reset();
+	r.client.reset();
+	r.app.reset();
+}
+
+// Print the summary and a line per account.
+void sync_engine::report(unsigned long elapsed_ms, uint64_t wire, uint64_t decoded) const
+{
+	unsigned n_ok = 0, d_ok = 0, d_failed = 0, d_changed = 0;
+	std::vector<unsigned long> lat;
+	lat.reserve(outcomes.size());
+	for (unsigned i = 0; i < outcomes.size(); ++i)
+	{
+		const sync_outcome& o = outcomes[i];
+		if (!o.error) { ++n_ok; }
+		d_ok      += o.days_ok;
+		d_failed  += o.days_failed;
+		d_changed += o.days_changed;
+		lat.push_back(o.total_ms);
+	}
+	std::sort(lat.begin(), lat.end());
+
+	unsigned long lat_sum = 0;
+	for (unsigned i = 0; i < lat.size(); ++i)
+	{
+		lat_sum += lat[i];
+	}
+
+	// Nearest-rank percentile.
+	auto l_pct = [&lat](unsigned p) { return lat[(lat.size() * p + 99) / 100 - 1]; };
+
+	double secs = std::max(elapsed_ms, 1ul) / 1000.0;
+	printf("Synced %u accounts in %.1f s (%.2f accounts/s, %.2f days/s).\n",
+		(unsigned)outcomes.size(), secs, outcomes.size() / secs, d_ok / secs);
+	printf("Accounts: %u ok, %u failed. Days: %u fetched, %u changed, %u failed.\n",
+		n_ok, (unsigned)outcomes.size() - n_ok, d_ok, d_changed, d_failed);
+	printf("Account latency: avg %lu ms, p50 %lu ms, p95 %lu ms, max %lu ms.\n",
+		lat_sum / lat.size(), l_pct(50), l_pct(95), lat.back());
+	printf("Received %.1f MB on the wire, %.1f MB decoded (%.1fx).\n\n",
+		wire / 1048576.0, decoded / 1048576.0, wire ? (double)decoded / wire : 1.0);
+
+	printf("%-24s %8s %8s %8s %7s %7s  %s\n",
+		"ACCOUNT", "LOGIN", "FETCH", "TOTAL", "DAYS", "CHANGED", "ERROR");
+	for (unsigned i = 0; i < outcomes.size(); ++i)
+	{
+		const sync_outcome& o = outcomes[i];
+		char s_days[24];
+		sprintf(s_days, "%u/%u", o.days_ok, days);
+		printf("%-24s %8lu %8lu %8lu %7s %7u  %s\n",
+			accounts[i].username.c_str(), o.login_ms, o.fetch_ms, o.total_ms,
+			s_days, o.days_changed, o.error ? o.error : "");
+	}
+}
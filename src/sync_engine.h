@@ -0,0 +1,104 @@
+#ifndef COH_SYNC_ENGINE_H
+#define COH_SYNC_ENGINE_H
+
+/*
+ * sync_engine.h
+ * - Headless --sync mode. Logs in and fetches a range of days for
+ *   every account in a manifest.
+ * - Each account gets its own directory under COH_SYNC_DIR, holding
+ *   its cookie jar and cache, so accounts never share sessions or days.
+ * - Every account runs as a session_task on one net_loop, so a
+ *   single thread keeps many accounts going at once. Only so many
+ *   run at a time; the next starts as each one finishes.
+ * - Accounts at the same school share its connection pool, and one
+ *   request_policy, so rate limits and the circuit breaker apply to
+ *   the school's host as a whole.
+ * - Prints throughput, failures and per-account latency at the end.
+ */
+
+#include "datetime_dmy.h"
+
+class application;
+class net_client;
+class net_loop;
+class request_policy;
+class session_task;
+
+// One line of the manifest.
+struct sync_account
+{
+	std::string name;       // Directory name. (The username, made safe.)
+	std::string username;
+	std::string password;
+	std::string prefs_path;
+};
+
+// How syncing one account went.
+struct sync_outcome
+{
+	const char* error;      // Why it failed. Null if it didn't.
+	unsigned days_ok;
+	unsigned days_failed;
+	unsigned days_changed;
+	unsigned long login_ms; // Zero if we re-used a session.
+	unsigned long fetch_ms;
+	unsigned long total_ms;
+};
+
+class sync_engine
+{
+public:
+	sync_engine(const datetime_dmy&, unsigned, unsigned);
+	~sync_engine();
+
+	// Read the accounts manifest. Returns false if it's unusable.
+	bool load_manifest(const std::string&);
+
+	// Sync every account. Returns the exit code.
+	int run(void);
+
+private:
+	// The accounts, and how each went. (Same indices.)
+	std::vector<sync_account> accounts;
+	std::vector<sync_outcome> outcomes;
+
+	// An account being synced, and when it started.
+	struct running_account
+	{
+		std::unique_ptr<application> app;
+		std::unique_ptr<net_client> client;
+		std::unique_ptr<session_task> task;
+		std::chrono::steady_clock::time_point t0;
+	};
+	std::vector<running_account> running;
+
+	// Policies shared by every account at a host.
+	std::unordered_map<std::string, std::shared_ptr<request_policy>> host_policies;
+
+	// The loop everything runs on, while we're running.
+	net_loop* loop;
+
+	// Next account to start.
+	unsigned next;
+
+	// First day, how many days, and how many accounts at once.
+	datetime_dmy from;
+	unsigned days;
+	unsigned jobs;
+
+private:
+	// Start the next account, skipping any that fail to set up.
+	void start_next(void);
+
+	// Set up and start an account. False if it failed to.
+	bool start_one(unsigned);
+
+	// An account finished, with an error or null.
+	void account_done(unsigned, const char*);
+
+	// Print the summary, given how long it took and the bytes
+	// received (on the wire, then decoded).
+	void report(unsigned long, uint64_t, uint64_t) const;
+};
+
+#endif
@@ -0,0 +1,99 @@
+
+/*
+ * term_meter.cpp
+ * Implementations of term_meter.h methods.
+ */
+
+#include "pch.h"
+#include "term_meter.h"
+
+// Constructor.
+term_meter::term_meter()
+	: fd(-1), mark(0), key_pending(false),
+	frames(0), frame_bytes(0), frame_max(0),
+	keys(0), key_bytes(0), key_max(0), keys_over(0)
+{
+	fd = open("/proc/thread-self/io", O_RDONLY | O_CLOEXEC);
+	if (fd < 0)
+	{
+		LOG_WARN("Can't count terminal output: %s", strerror(errno));
+	}
+}
+
+// Destructor.
+term_meter::~term_meter()
+{
+	if (fd >= 0) { close(fd); }
+}
+
+// A frame is about to go out.
+void term_meter::frame_begin(void)
+{
+	mark = written();
+}
+
+// A frame went out.
+void term_meter::frame_end(void)
+{
+	uint64_t n = written() - mark;
+	if (!n && !key_pending)
+	{
+		return;
+	}
+	++frames;
+	frame_bytes += n;
+	frame_max = std::max(frame_max, n);
+
+	if (!key_pending)
+	{
+		return;
+	}
+	key_pending = false;
+	++keys;
+	key_bytes += n;
+	key_max = std::max(key_max, n);
+	if (n > COH_WND_KEY_BYTES_BUDGET)
+	{
+		++keys_over;
+		LOG_WARN("Key press took %llu bytes to draw, over the budget of %u.",
+			(unsigned long long)n, COH_WND_KEY_BYTES_BUDGET);
+	}
+}
+
+// Print the summary.
+void term_meter::report(FILE* f) const
+{
+	if (!is_ready())
+	{
+		fprintf(f, "Terminal output wasn't counted. (No /proc/thread-self/io.)\n");
+		return;
+	}
+	fprintf(f, "Terminal output: %llu bytes in %llu frames (avg %llu, max %llu).\n",
+		(unsigned long long)frame_bytes, (unsigned long long)frames,
+		(unsigned long long)(frames ? frame_bytes / frames : 0), (unsigned long long)frame_max);
+	fprintf(f, "Key presses: %llu, drawn in %llu bytes (avg %llu, max %llu). "
+		"%llu over the %u byte budget.\n",
+		(unsigned long long)keys, (unsigned long long)key_bytes,
+		(unsigned long long)(keys ? key_bytes / keys : 0), (unsigned long long)key_max,
+		(unsigned long long)keys_over, COH_WND_KEY_BYTES_BUDGET);
+}
+
+// Read the thread's write count.
+uint64_t term_meter::written(void) const
+{
+	if (fd < 0)
+	{
+		return 0;
+	}
+
+	// "wchar: N" is the second line.
+	char buf[256];
+	ssize_t n = pread(fd, buf, sizeof(buf) - 1, 0);
+	if (n <= 0)
+	{
+		return 0;
+	}
+	buf[n] = '\0';
+	const char* w = strstr(buf, "wchar:");
+	return w ? strtoull(w + 6, nullptr, 10) : 0;
+}
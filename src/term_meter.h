@@ -0,0 +1,56 @@
+#ifndef COH_TERM_METER_H
+#define COH_TERM_METER_H
+
+/*
+ * term_meter.h
+ * - Counts the bytes sent to the terminal, per frame and per key
+ *   press, for --bandwidth-report.
+ * - ncurses writes to the terminal itself, so we can't see what it
+ *   sends. Instead we read how much the UI thread has written, from
+ *   /proc/thread-self/io, before and after each frame goes out.
+ *   Nothing else on the UI thread writes while it does.
+ * - A key press is charged for the frame drawn in response to it.
+ *   Any over COH_WND_KEY_BYTES_BUDGET are logged and counted.
+ */
+
+class term_meter
+{
+public:
+	// Must be made on the thread that draws.
+	term_meter();
+	~term_meter();
+
+	// Whether we can count. (The kernel may not keep the counts.)
+	inline bool is_ready(void) const
+	{
+		return fd >= 0;
+	}
+
+	// Around sending a frame.
+	void frame_begin(void);
+	void frame_end(void);
+
+	// A key was pressed. The next frame is its response.
+	inline void key(void)
+	{
+		key_pending = true;
+	}
+
+	// Print the summary.
+	void report(FILE*) const;
+
+private:
+	int fd;
+	uint64_t mark;
+	bool key_pending;
+
+	// Every frame, and the frames that answered a key press.
+	uint64_t frames, frame_bytes, frame_max;
+	uint64_t keys, key_bytes, key_max, keys_over;
+
+private:
+	// Bytes the thread has written so far.
+	uint64_t written(void) const;
+};
+
+#endif
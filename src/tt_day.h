@@ -15,6 +15,9 @@ struct tt_day
 	std::vector<tt_period> events;
 	datetime retrieved;
 
+	// Fingerprint of the response this came from. (See util::json_fingerprint)
+	std::string fingerprint;
+
 	// Constructor.
 	tt_day()
 		: retrieved(datetime())
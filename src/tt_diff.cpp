@@ -0,0 +1,292 @@
+
+/*
+ * tt_diff.cpp
+ * Implementations of tt_diff.h methods.
+ */
+
+#include "pch.h"
+#include "datetime.h"
+#include "tt_day.h"
+#include "tt_diff.h"
+#include "tt_period.h"
+
+// Workers may log changes at the same time.
+static std::mutex log_mtx;
+
+// The key we match periods up with.
+struct diff_key
+{
+	unsigned begin, end; // In minutes.
+	const std::string* subject;
+	unsigned idx;
+
+	inline bool operator<(const diff_key& o) const
+	{
+		if (begin != o.begin) { return begin < o.begin; }
+		if (end   != o.end)   { return end   < o.end;   }
+		return *subject < *o.subject;
+	}
+	inline bool same(const diff_key& o) const
+	{
+		return begin == o.begin && end == o.end && *subject == *o.subject;
+	}
+};
+
+// Get the subject we match on. Parsed periods use the subject name,
+// everything else uses the whole title.
+static inline const std::string& diff_subject(const tt_period& p)
+{
+	return p.title_parsed ? p.t_subj : p.title;
+}
+
+// Build sorted keys for a vector of periods.
+static void diff_keys(const std::vector<tt_period>& v, std::vector<diff_key>& outp)
+{
+	outp.clear();
+	outp.reserve(v.size());
+	for (unsigned i = 0; i < v.size(); ++i)
+	{
+		const tt_period& p = v[i];
+		outp.push_back({
+			p.begin.hour * 60 + p.begin.minute,
+			p.end.hour   * 60 + p.end.minute,
+			&diff_subject(p), i
+		});
+	}
+	std::sort(outp.begin(), outp.end());
+}
+
+// Compare two matched periods.
+static void diff_pair(const tt_period& o, const tt_period& n, int id, std::vector<tt_change>& outp)
+{
+	const std::string& subj = diff_subject(n);
+
+	// Cancelled trumps everything else.
+	if (n.state != o.state)
+	{
+		if (n.state == period_state::CANCELLED)
+		{
+			outp.emplace_back(id, change_type::CHG_CANCELLED, n.begin, n.end, subj);
+			return;
+		}
+		// Room/teacher changes come through as CHANGED as well.
+		// Only log the state if they don't explain it.
+		if (o.t_room == n.t_room && o.t_tchr == n.t_tchr)
+		{
+			char s_o[4], s_n[4];
+			sprintf(s_o, "%u", (unsigned)o.state);
+			sprintf(s_n, "%u", (unsigned)n.state);
+			outp.emplace_back(id, change_type::CHG_STATE, n.begin, n.end, subj, s_o, s_n);
+		}
+	}
+	if (o.t_room != n.t_room)
+	{
+		outp.emplace_back(id, change_type::CHG_ROOM, n.begin, n.end, subj, o.t_room, n.t_room);
+	}
+	if (o.t_tchr != n.t_tchr)
+	{
+		outp.emplace_back(id, change_type::CHG_SUBSTITUTE, n.begin, n.end, subj, o.t_tchr, n.t_tchr);
+	}
+}
+
+// Diff one vector of periods. Merges the two sorted key lists.
+static void diff_vec(const std::vector<tt_period>& vo, const std::vector<tt_period>& vn,
+	int id, std::vector<tt_change>& outp)
+{
+	std::vector<diff_key> ko, kn;
+	diff_keys(vo, ko);
+	diff_keys(vn, kn);
+
+	unsigned i = 0, j = 0;
+	while (i < ko.size() || j < kn.size())
+	{
+		if (i < ko.size() && j < kn.size() && ko[i].same(kn[j]))
+		{
+			diff_pair(vo[ko[i].idx], vn[kn[j].idx], id, outp);
+			++i; ++j;
+		}
+		else if (j >= kn.size() || (i < ko.size() && ko[i] < kn[j]))
+		{
+			const tt_period& p = vo[ko[i++].idx];
+			outp.emplace_back(id, change_type::CHG_REMOVED, p.begin, p.end, diff_subject(p));
+		}
+		else
+		{
+			const tt_period& p = vn[kn[j++].idx];
+			outp.emplace_back(id, change_type::CHG_NEW, p.begin, p.end, diff_subject(p));
+		}
+	}
+}
+
+// Diff two days.
+void tt_diff::diff(const tt_day& o, const tt_day& n, int id, std::vector<tt_change>& outp)
+{
+	diff_vec(o.periods, n.periods, id, outp);
+	diff_vec(o.events,  n.events,  id, outp);
+}
+
+// Append changes to the log.
+// Each line is: logged time (UTC epoch), date ID, type, begin, end,
+// subject, from, to. Separated by the cache delimiter.
+void tt_diff::log_append(const std::vector<tt_change>& changes, const std::string& path)
+{
+	if (changes.empty())
+	{
+		return;
+	}
+
+	std::lock_guard<std::mutex> lk(log_mtx);
+	FILE* f = fopen(path.c_str(), "a");
+	if (!f)
+	{
+		LOG_ERROR("Couldn't open change log for appending.");
+		return;
+	}
+
+	long now = (long)std::time(0);
+	for (unsigned i = 0; i < changes.size(); ++i)
+	{
+		const tt_change& c = changes[i];
+		fprintf(f,
+			"%ld" COH_CACHE_DELIM
+			"%d" COH_CACHE_DELIM
+			"%u" COH_CACHE_DELIM
+			"%02u:%02u" COH_CACHE_DELIM
+			"%02u:%02u" COH_CACHE_DELIM
+			"%s" COH_CACHE_DELIM
+			"%s" COH_CACHE_DELIM
+			"%s\n",
+			now, c.date_id, (unsigned)c.type,
+			c.begin.hour, c.begin.minute,
+			c.end.hour, c.end.minute,
+			c.subject.c_str(), c.from.c_str(), c.to.c_str()
+		);
+	}
+	fclose(f);
+
+	LOG_INFO("Logged %u timetable changes.", changes.size());
+}
+
+// Print everything logged since the given time.
+// The log is in the order it was written, so we binary search on the
+// file offset for the first line we want, then read from there.
+unsigned tt_diff::log_print_since(std::time_t since, FILE* out, const std::string& path)
+{
+	std::ifstream f(path);
+	if (!f.good())
+	{
+		return 0;
+	}
+
+	std::string line;
+
+	// Get the logged time of the first whole line at or after pos.
+	// Returns false if there isn't one.
+	auto l_time_after = [&](std::streamoff pos, long* t)
+	{
+		f.clear();
+		f.seekg(pos);
+		if (pos > 0) { std::getline(f, line); }
+		return std::getline(f, line) && sscanf(line.c_str(), "%ld", t) == 1;
+	};
+
+	f.seekg(0, std::ios::end);
+	std::streamoff lo = 0, hi = f.tellg();
+	while (hi - lo > 4096)
+	{
+		std::streamoff mid = lo + (hi - lo) / 2;
+		long t;
+		if (l_time_after(mid, &t) && t < since)
+		{
+			lo = mid;
+		}
+		else
+		{
+			hi = mid;
+		}
+	}
+
+	// Read from lo onwards.
+	f.clear();
+	f.seekg(lo);
+	if (lo > 0) { std::getline(f, line); }
+
+	unsigned count = 0;
+	while (std::getline(f, line))
+	{
+		long t;
+		int id;
+		unsigned type, bh, bm, eh, em;
+		int n_fixed = 0;
+		if (sscanf(line.c_str(),
+			"%ld" COH_CACHE_DELIM
+			"%d" COH_CACHE_DELIM
+			"%u" COH_CACHE_DELIM
+			"%02u:%02u" COH_CACHE_DELIM
+			"%02u:%02u" COH_CACHE_DELIM "%n",
+			&t, &id, &type, &bh, &bm, &eh, &em, &n_fixed) != 7 || !n_fixed)
+		{
+			continue;
+		}
+		if (t < since)
+		{
+			continue;
+		}
+
+		// Remaining fields are subject, from, to.
+		std::string rest = line.substr(n_fixed);
+		std::string fields[3];
+		for (unsigned i = 0, start = 0; i < 3; ++i)
+		{
+			size_t d = rest.find(COH_CACHE_DELIM, start);
+			fields[i] = rest.substr(start, d == std::string::npos ? std::string::npos : d - start);
+			start = (d == std::string::npos) ? rest.length() : d + 1;
+		}
+
+		tt_change c(id, (change_type)type, time_of_day(bh, bm), time_of_day(eh, em),
+			fields[0], fields[1], fields[2]);
+
+		// Logged time in local time.
+		std::time_t tt = (std::time_t)t;
+		std::tm lt;
+		localtime_r(&tt, &lt);
+
+		fprintf(out, "%04d-%02d-%02d %02d:%02d  %s\n",
+			lt.tm_year + 1900, lt.tm_mon + 1, lt.tm_mday, lt.tm_hour, lt.tm_min,
+			change_str(c).c_str());
+		++count;
+	}
+	return count;
+}
+
+// Human-readable line for a change.
+std::string tt_diff::change_str(const tt_change& c)
+{
+	char head[40];
+	sprintf(head, "%02d.%02d.%04d  %02u:%02u-%02u:%02u  ",
+		c.date_id % 100, c.date_id / 100 % 100, c.date_id / 10000,
+		c.begin.hour, c.begin.minute, c.end.hour, c.end.minute);
+
+	std::string ret = head;
+	ret += c.subject + ": " + type_str(c.type);
+	if (!c.from.empty() || !c.to.empty())
+	{
+		ret += " (" + c.from + " -> " + c.to + ")";
+	}
+	return ret;
+}
+
+// Name of a change type.
+const char* tt_diff::type_str(change_type t)
+{
+	switch (t)
+	{
+		case (change_type::CHG_ROOM):       return "room changed";
+		case (change_type::CHG_SUBSTITUTE): return "substitute teacher";
+		case (change_type::CHG_CANCELLED):  return "cancelled";
+		case (change_type::CHG_NEW):        return "new";
+		case (change_type::CHG_REMOVED):    return "removed";
+		case (change_type::CHG_STATE):      return "state changed";
+	}
+	return "unknown";
+}
@@ -0,0 +1,73 @@
+#ifndef COH_TT_DIFF_H
+#define COH_TT_DIFF_H
+
+/*
+ * tt_diff.h
+ * - Works out what changed between two copies of a day,
+ *   and keeps an append-only log of those changes on disk.
+ * - Periods are matched up by their (begin, end, subject).
+ */
+
+#include "time_of_day.h"
+
+struct tt_day;
+
+// The kinds of change we record.
+enum change_type : char
+{
+	CHG_ROOM       = 0, // Same period, different room.
+	CHG_SUBSTITUTE = 1, // Same period, different teacher.
+	CHG_CANCELLED  = 2, // Period became cancelled.
+	CHG_NEW        = 3, // Period/event that wasn't there before.
+	CHG_REMOVED    = 4, // Period/event that has disappeared.
+	CHG_STATE      = 5  // Any other change of period state.
+};
+
+// A single change to a day.
+struct tt_change
+{
+	int date_id;         // Day this happened on. (See datetime_dmy_id)
+	change_type type;
+	time_of_day begin;
+	time_of_day end;
+	std::string subject;
+	std::string from;    // Old value, if the type has one.
+	std::string to;      // New value, if the type has one.
+
+	tt_change(int id, change_type t, const time_of_day& b, const time_of_day& e,
+		const std::string& s, const std::string& f="", const std::string& n="")
+		: date_id(id), type(t), begin(b), end(e), subject(s), from(f), to(n)
+	{}
+};
+
+namespace tt_diff
+{
+	/*
+	 * Compare the old and new copies of day ID, appending
+	 * the changes to outp. The days can be in any order.
+	 */
+	void diff(const tt_day&, const tt_day&, int, std::vector<tt_change>&);
+
+	/*
+	 * Append changes to a change log on disk.
+	 */
+	void log_append(const std::vector<tt_change>&, const std::string& path=COH_CHANGE_LOG_PATH);
+
+	/*
+	 * Print every change logged at or after the given time.
+	 * Returns the number of changes printed.
+	 */
+	unsigned log_print_since(std::time_t, FILE*, const std::string& path=COH_CHANGE_LOG_PATH);
+
+	/*
+	 * Human-readable line for a change. (No newline.)
+	 */
+	std::string change_str(const tt_change&);
+
+	/*
+	 * Name of a change type.
+	 */
+	const char* type_str(change_type);
+}
+
+#endif
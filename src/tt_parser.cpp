@@ -107,8 +107,10 @@ bool tt_parser::parse_json(
 		S_JSONASSERT(!success, "Couldn't get epoch Start Time." );
 		std::time_t utc_finish = get_epoch_time(j_finish, &success);
 		S_JSONASSERT(!success, "Couldn't get epoch Finish Time.");
-		std::tm local_start    = *localtime(&utc_start );
-		std::tm local_finish   = *localtime(&utc_finish);
+		// (Re-entrant versions, as we may be on a worker thread.)
+		std::tm local_start, local_finish;
+		localtime_r(&utc_start,  &local_start );
+		localtime_r(&utc_finish, &local_finish);
 
 		bool event = (s & period_state::EVENT) == period_state::EVENT;
 
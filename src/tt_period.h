@@ -38,6 +38,20 @@ struct tt_period
 	// Constructor.
 	tt_period(const std::string&, const time_of_day&,
 			const time_of_day&, const period_state, const prefs&);
+
+	// Periods are the same if Compass gave us the same data.
+	// (The parsed title parts are derived from the title.)
+	inline bool operator==(const tt_period& other) const
+	{
+		return title == other.title
+			&& begin == other.begin
+			&& end   == other.end
+			&& state == other.state;
+	}
+	inline bool operator!=(const tt_period& other) const
+	{
+		return !(*this == other);
+	}
 };
 
 #endif
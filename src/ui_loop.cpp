@@ -0,0 +1,178 @@
+
+/*
+ * ui_loop.cpp
+ * Implementations of ui_loop.h methods.
+ */
+
+#include "pch.h"
+#include "ui_loop.h"
+
+// Constructor.
+ui_loop::ui_loop()
+	: epfd(-1), sigfd(-1), evfd(-1), timerfd(-1)
+{
+	epfd = epoll_create1(EPOLL_CLOEXEC);
+	if (epfd < 0)
+	{
+		LOG_ERROR("Couldn't create epoll instance: %s", strerror(errno));
+		return;
+	}
+
+	// Resizes. The signal is blocked, so it only arrives here.
+	sigset_t set;
+	sigemptyset(&set);
+	sigaddset(&set, SIGWINCH);
+	sigfd = signalfd(-1, &set, SFD_NONBLOCK | SFD_CLOEXEC);
+
+	evfd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+	timerfd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+
+	if (!watch(STDIN_FILENO) || !watch(sigfd) || !watch(evfd) || !watch(timerfd))
+	{
+		LOG_ERROR("Couldn't set up the UI loop: %s", strerror(errno));
+		close(epfd);
+		epfd = -1;
+	}
+}
+
+// Destructor.
+ui_loop::~ui_loop()
+{
+	if (timerfd >= 0) { close(timerfd); }
+	if (evfd >= 0)    { close(evfd); }
+	if (sigfd >= 0)   { close(sigfd); }
+	if (epfd >= 0)    { close(epfd); }
+}
+
+// Block the signals we take through the loop.
+void ui_loop::block_signals(void)
+{
+	sigset_t set;
+	sigemptyset(&set);
+	sigaddset(&set, SIGWINCH);
+	pthread_sigmask(SIG_BLOCK, &set, nullptr);
+}
+
+// Wait for something to happen.
+unsigned ui_loop::wait(void)
+{
+	// Without epoll, look for everything every so often.
+	if (epfd < 0)
+	{
+		std::this_thread::sleep_for(std::chrono::milliseconds(COH_WND_POLL_MS));
+		run_timers();
+		return UI_EV_INPUT | UI_EV_POSTED;
+	}
+
+	epoll_event evs[4];
+	int n = epoll_wait(epfd, evs, 4, -1);
+	if (n < 0)
+	{
+		if (errno != EINTR)
+		{
+			LOG_ERROR("UI loop epoll_wait failed: %s", strerror(errno));
+		}
+		return 0;
+	}
+
+	unsigned ev = 0;
+	for (int i = 0; i < n; ++i)
+	{
+		int fd = evs[i].data.fd;
+		if (fd == STDIN_FILENO)
+		{
+			ev |= UI_EV_INPUT;
+		}
+		else if (fd == sigfd)
+		{
+			// Several resizes may have queued up. One will do.
+			signalfd_siginfo si;
+			while (read(sigfd, &si, sizeof(si)) == sizeof(si));
+			ev |= UI_EV_RESIZE;
+		}
+		else if (fd == evfd)
+		{
+			uint64_t v;
+			if (read(evfd, &v, sizeof(v)) == sizeof(v))
+			{
+				ev |= UI_EV_POSTED;
+			}
+		}
+		else if (fd == timerfd)
+		{
+			uint64_t v;
+			if (read(timerfd, &v, sizeof(v)) == sizeof(v))
+			{
+				run_timers();
+			}
+		}
+	}
+	return ev;
+}
+
+// Wake the waiting thread.
+void ui_loop::wake(void)
+{
+	uint64_t v = 1;
+	if (evfd >= 0 && write(evfd, &v, sizeof(v)) != sizeof(v))
+	{
+		LOG_WARN("Couldn't wake the UI loop: %s", strerror(errno));
+	}
+}
+
+// Call a function later.
+void ui_loop::after(unsigned long ms, std::function<void(void)> fn)
+{
+	timers.emplace(clock::now() + std::chrono::milliseconds(ms), std::move(fn));
+	arm();
+}
+
+// Watch a descriptor.
+bool ui_loop::watch(int fd)
+{
+	if (fd < 0)
+	{
+		return false;
+	}
+	epoll_event e = {};
+	e.events  = EPOLLIN;
+	e.data.fd = fd;
+	return epoll_ctl(epfd, EPOLL_CTL_ADD, fd, &e) == 0;
+}
+
+// Run the timers that are due.
+void ui_loop::run_timers(void)
+{
+	// A timer may add another, so take each out before running it.
+	auto now = clock::now();
+	while (!timers.empty() && timers.begin()->first <= now)
+	{
+		std::function<void(void)> fn = std::move(timers.begin()->second);
+		timers.erase(timers.begin());
+		fn();
+	}
+	arm();
+}
+
+// Arm the timerfd for the soonest timer, or disarm it if there isn't one.
+// (steady_clock is CLOCK_MONOTONIC, so its times go straight in.)
+void ui_loop::arm(void)
+{
+	if (timerfd < 0)
+	{
+		return;
+	}
+
+	itimerspec its = {};
+	if (!timers.empty())
+	{
+		auto ns = std::chrono::duration_cast<std::chrono::nanoseconds>(
+			timers.begin()->first.time_since_epoch()).count();
+
+		// Zero would disarm it, so anything due now fires straight away.
+		if (ns <= 0) { ns = 1; }
+		its.it_value.tv_sec  = ns / 1000000000;
+		its.it_value.tv_nsec = ns % 1000000000;
+	}
+	timerfd_settime(timerfd, TFD_TIMER_ABSTIME, &its, nullptr);
+}
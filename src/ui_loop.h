@@ -0,0 +1,64 @@
+#ifndef COH_UI_LOOP_H
+#define COH_UI_LOOP_H
+
+/*
+ * ui_loop.h
+ * - Waits on everything the UI reacts to at once: key presses, the
+ *   terminal being resized, timers, and work posted from other
+ *   threads. The UI thread sleeps in epoll until one of them happens,
+ *   instead of waking up every so often to look.
+ * - Resizes come in through a signalfd, so SIGWINCH has to be blocked
+ *   on every thread. Call block_signals before starting any.
+ * - Timers share one timerfd, armed for the soonest of them.
+ */
+
+class ui_loop
+{
+public:
+	// What woke us up, besides timers.
+	enum ui_event : unsigned
+	{
+		UI_EV_INPUT  = 1, // Keys to read.
+		UI_EV_RESIZE = 2, // The terminal changed size.
+		UI_EV_POSTED = 4  // Another thread called wake().
+	};
+
+	ui_loop();
+	~ui_loop();
+
+	// Block the signals the loop takes, on this thread and any
+	// threads it starts afterwards.
+	static void block_signals(void);
+
+	// Sleep until something happens, and run the timers that are due.
+	// Returns the ui_event flags for whatever else happened.
+	unsigned wait(void);
+
+	// Wake wait() up. Safe from any thread.
+	void wake(void);
+
+	// Call a function from wait() after some milliseconds.
+	// Only from the thread that waits.
+	void after(unsigned long ms, std::function<void(void)>);
+
+private:
+	typedef std::chrono::steady_clock clock;
+
+	int epfd;
+	int sigfd;   // SIGWINCH.
+	int evfd;    // Wakes from other threads.
+	int timerfd; // The soonest timer.
+
+	// Pending timers, soonest first.
+	std::multimap<clock::time_point, std::function<void(void)>> timers;
+
+private:
+	// Watch a descriptor for reading.
+	bool watch(int);
+
+	// Run the timers that are due, and arm the timerfd for the next.
+	void run_timers(void);
+	void arm(void);
+};
+
+#endif
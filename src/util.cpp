@@ -10,35 +10,45 @@
  * This provides a string URL-encoding method which is used to
  * pass URL parameters to the site where needed.
  *
- * Thanks to xperroni for the code:
- * https://stackoverflow.com/a/17708801
+ * Each byte is looked up in a table of which are left alone, and
+ * the rest become %XX.
  */
-std::string util::url_encode(const std::string& value)
+void util::url_encode(std::string& out, std::string_view value)
 {
-	using namespace std;
-
-	ostringstream escaped;
-	escaped.fill('0');
-	escaped << hex;
-
-	for (string::const_iterator i = value.begin(), n = value.end(); i != n; ++i)
+	// Alphanumeric and other accepted characters are kept intact.
+	static const std::array<bool, 256> keep = []()
 	{
-		string::value_type c = (*i);
+		std::array<bool, 256> t = {};
+		for (int c = 0; c < 256; ++c)
+		{
+			t[c] = (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || (c >= '0' && c <= '9')
+				|| c == '-' || c == '_' || c == '.' /* || c == '~'*/;
+		}
+		return t;
+	}();
+	static const char hex[] = "0123456789ABCDEF";
 
-		// Keep alphanumeric and other accepted characters intact
-		if (isalnum(c) || c == '-' || c == '_' || c == '.' /* || c == '~'*/)
+	out.reserve(out.length() + value.length() * 3);
+	for (unsigned char c : value)
+	{
+		if (keep[c])
 		{
-			escaped << c;
+			out += (char)c;
 			continue;
 		}
 
 		// Any other characters are percent-encoded
-		escaped << uppercase;
-		escaped << '%' << setw(2) << int((unsigned char) c);
-		escaped << nouppercase;
+		out += '%';
+		out += hex[c >> 4];
+		out += hex[c & 15];
 	}
+}
 
-	return escaped.str();
+std::string util::url_encode(const std::string& value)
+{
+	std::string out;
+	url_encode(out, value);
+	return out;
 }
 
 // Converts a 3-letter month string to a number.
@@ -62,6 +72,66 @@ unsigned util::month_lookup_from_str(const char* month)
 	return 0;
 }
 
+/*
+ * Hash a JSON response so we can tell if it changed without parsing it.
+ * We canonicalise by dropping whitespace outside of strings, so
+ * re-formatting on the server's end doesn't count as a change.
+ * Runs are fed to the digest as-is, so there is no copy of the body.
+ */
+std::string util::json_fingerprint(const std::string& body)
+{
+	EVP_MD_CTX* ctx = EVP_MD_CTX_new();
+	if (!ctx || !EVP_DigestInit_ex(ctx, EVP_sha256(), nullptr))
+	{
+		LOG_ERROR("Couldn't initialise SHA-256 digest.");
+		EVP_MD_CTX_free(ctx);
+		return "";
+	}
+
+	const char* p = body.data();
+	const char* run = p;
+	const char* end = p + body.size();
+	bool in_str = false;
+	for (; p != end; ++p)
+	{
+		char c = *p;
+		if (in_str)
+		{
+			// Skip escaped chars, so \" doesn't end the string.
+			if (c == '\\' && p + 1 != end) { ++p; }
+			else if (c == '"') { in_str = false; }
+			continue;
+		}
+		if (c == '"')
+		{
+			in_str = true;
+			continue;
+		}
+		if (c == ' ' || c == '\t' || c == '\n' || c == '\r')
+		{
+			// Flush the run before this whitespace.
+			EVP_DigestUpdate(ctx, run, p - run);
+			run = p + 1;
+		}
+	}
+	EVP_DigestUpdate(ctx, run, end - run);
+
+	unsigned char md[EVP_MAX_MD_SIZE];
+	unsigned md_len = 0;
+	EVP_DigestFinal_ex(ctx, md, &md_len);
+	EVP_MD_CTX_free(ctx);
+
+	// Convert to hex.
+	static const char HEX[] = "0123456789abcdef";
+	std::string ret(md_len * 2, '0');
+	for (unsigned i = 0; i < md_len; ++i)
+	{
+		ret[i * 2]     = HEX[md[i] >> 4];
+		ret[i * 2 + 1] = HEX[md[i] & 0xF];
+	}
+	return ret;
+}
+
 // Gets the day of the week as a string.
 std::string util::get_day_of_week_str(uint8_t i)
 {
@@ -70,3 +140,65 @@ std::string util::get_day_of_week_str(uint8_t i)
 	};
 	return DAYS_OF_WEEK[i];
 }
+
+// Word wrap a string. Widths come from wcwidth, so wide (CJK) and
+// zero-width chars take up what they do on screen.
+void util::wrap(std::vector<std::string>& out, std::string_view s, unsigned width)
+{
+	static const size_t NONE = std::string_view::npos;
+
+	size_t line = 0;       // Where this line starts.
+	size_t brk = NONE;     // The last space on it.
+	unsigned w = 0;        // Its width so far.
+	unsigned w_brk = 0;    // Its width up to and including the space.
+	std::mbstate_t st = {};
+	for (size_t i = 0; i < s.size(); )
+	{
+		// Decode a char. Bytes that aren't valid go one column each.
+		wchar_t wc = 0;
+		size_t n = std::mbrtowc(&wc, s.data() + i, s.size() - i, &st);
+		int cw = 1;
+		if (n == (size_t)-1 || n == (size_t)-2)
+		{
+			n = 1;
+			wc = 0;
+			st = {};
+		}
+		else
+		{
+			if (n == 0) { n = 1; }
+			cw = std::max(wcwidth(wc), 0);
+		}
+
+		// Doesn't fit. Break here if this is a space (which then
+		// goes), or at the last space, or right here if there wasn't
+		// one. (A line always gets at least one char.)
+		if (w + cw > width && i > line)
+		{
+			if (brk != NONE && wc != L' ')
+			{
+				out.emplace_back(s.substr(line, brk - line));
+				line = brk + 1;
+				w -= w_brk;
+			}
+			else
+			{
+				out.emplace_back(s.substr(line, i - line));
+				if (wc == L' ') { i += n; }
+				line = i;
+				w = 0;
+			}
+			brk = NONE;
+			continue;
+		}
+
+		if (wc == L' ')
+		{
+			brk = i;
+			w_brk = w + cw;
+		}
+		w += cw;
+		i += n;
+	}
+	out.emplace_back(s.substr(line));
+}
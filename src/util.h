@@ -7,7 +7,8 @@
 
 namespace util
 {
-	// Encode URL
+	// Encode URL, either appending to a string or as a new one.
+	extern void url_encode(std::string&, std::string_view);
 	extern std::string url_encode(const std::string&);
 
 	// Converts a 3-letter month string to a number.
@@ -15,6 +16,14 @@ namespace util
 
 	// Gets a day of week string.
 	extern std::string get_day_of_week_str(uint8_t);
+
+	// Word wrap a (multibyte) string to a width in terminal columns,
+	// appending the lines. Words too long for a line are split.
+	extern void wrap(std::vector<std::string>&, std::string_view, unsigned);
+
+	// SHA-256 (as hex) of a JSON body, ignoring whitespace
+	// outside of strings.
+	extern std::string json_fingerprint(const std::string&);
 }
 
 #endif
@@ -0,0 +1,175 @@
+
+/*
+ * watcher.cpp
+ * Implementations of watcher.h methods.
+ */
+
+#include "pch.h"
+#include "application.h"
+#include "datetime.h"
+#include "datetime_dmy.h"
+#include "net_client.h"
+#include "tt_day.h"
+#include "tt_diff.h"
+#include "tt_period.h"
+#include "watcher.h"
+
+// Set by SIGINT/SIGTERM to stop the loop. Also cancels
+// the poll in flight. (Lock-free, so fine in a handler.)
+static std::atomic<bool> watch_stop(false);
+
+// Constructor.
+watcher::watcher(application* const a, const std::string& h)
+	: app(a), hook(h), failures(0)
+{}
+
+// Poll until we're told to stop.
+int watcher::run(void)
+{
+	if (!app->client_get()->session_exists())
+	{
+		fprintf(stderr, "No saved session. Log in interactively first, or set cred_helper.\n");
+		return 1;
+	}
+
+	// Stop cleanly on Ctrl+C or kill. A hook that exits without
+	// reading its stdin shouldn't take us down either.
+	struct sigaction sigact_stop = {};
+	sigact_stop.sa_handler = [](int) { watch_stop = true; };
+	sigaction(SIGINT,  &sigact_stop, NULL);
+	sigaction(SIGTERM, &sigact_stop, NULL);
+	signal(SIGPIPE, SIG_IGN);
+
+	srand((unsigned)std::time(0) ^ (unsigned)getpid());
+	LOG_INFO("Watching timetable. Hook: '%s'", hook.c_str());
+
+	while (!watch_stop)
+	{
+		std::vector<tt_change> changes;
+		if (poll(changes))
+		{
+			failures = 0;
+			if (!changes.empty())
+			{
+				for (unsigned i = 0; i < changes.size(); ++i)
+				{
+					printf("%s\n", tt_diff::change_str(changes[i]).c_str());
+				}
+				fflush(stdout);
+				run_hook(changes);
+			}
+		}
+		else
+		{
+			++failures;
+		}
+
+		// Sleep in small steps so signals are noticed quickly.
+		unsigned wait = next_interval();
+		LOG_INFO("Next poll in %u seconds.", wait);
+		for (unsigned i = 0; i < wait && !watch_stop; ++i)
+		{
+			sleep(1);
+		}
+	}
+
+	LOG_INFO("Stopped watching.");
+	return 0;
+}
+
+// Fetch today and tomorrow.
+bool watcher::poll(std::vector<tt_change>& changes)
+{
+	datetime_dmy today = application::date_today();
+	datetime_dmy days[2] = { today, application::date_add(today, 1) };
+
+	bool ok = true;
+	for (unsigned i = 0; i < 2; ++i)
+	{
+		tt_day o;
+		request_ctx ctx(COH_NET_DEADLINE_RETRIEVE_MS, &watch_stop);
+		if (!app->get_tt_for_day_update(o, days[i], nullptr, &changes, ctx))
+		{
+			LOG_WARN("Watch poll failed for ID:%d.", datetime_dmy_id(days[i]).id);
+			ok = false;
+		}
+	}
+	return ok;
+}
+
+// Run the hook, passing the changes one per line on stdin.
+void watcher::run_hook(const std::vector<tt_change>& changes)
+{
+	if (hook.empty())
+	{
+		return;
+	}
+
+	FILE* p = popen(hook.c_str(), "w");
+	if (!p)
+	{
+		LOG_ERROR("Couldn't run watch hook '%s'.", hook.c_str());
+		return;
+	}
+	for (unsigned i = 0; i < changes.size(); ++i)
+	{
+		fprintf(p, "%s\n", tt_diff::change_str(changes[i]).c_str());
+	}
+	int status = pclose(p);
+	if (status != 0)
+	{
+		LOG_WARN("Watch hook exited with status %d.", status);
+	}
+}
+
+// Work out how long to wait.
+// - After errors, back off exponentially.
+// - Otherwise poll often before and during school on weekdays,
+//   less in the evening, and rarely at night and on weekends.
+unsigned watcher::next_interval(void) const
+{
+	unsigned base;
+	if (failures > 0)
+	{
+		// Cap the shift so it can't overflow.
+		unsigned shift = std::min(failures - 1, 16u);
+		base = std::min((unsigned)COH_WATCH_BACKOFF_MIN << shift, (unsigned)COH_WATCH_BACKOFF_MAX);
+	}
+	else
+	{
+		std::time_t n = std::time(0);
+		std::tm now;
+		localtime_r(&n, &now);
+
+		bool weekend = now.tm_wday == 0 || now.tm_wday == 6;
+		if (weekend)
+		{
+			base = COH_WATCH_INTERVAL_IDLE;
+		}
+		else if (now.tm_hour >= COH_WATCH_SCHOOL_BEGIN_HR && now.tm_hour < COH_WATCH_SCHOOL_END_HR)
+		{
+			base = COH_WATCH_INTERVAL_SCHOOL;
+		}
+		else if (now.tm_hour >= COH_WATCH_SCHOOL_END_HR && now.tm_hour < COH_WATCH_EVENING_END_HR)
+		{
+			base = COH_WATCH_INTERVAL_EVENING;
+		}
+		else
+		{
+			base = COH_WATCH_INTERVAL_IDLE;
+
+			// Don't sleep through the start of the school day.
+			if (now.tm_hour < COH_WATCH_SCHOOL_BEGIN_HR)
+			{
+				unsigned until_begin = (COH_WATCH_SCHOOL_BEGIN_HR - now.tm_hour) * 3600
+					- now.tm_min * 60 - now.tm_sec;
+				base = std::min(base, until_begin);
+			}
+		}
+	}
+
+	// Add jitter so many watchers don't poll in lockstep.
+	int jitter_max = (int)base * COH_WATCH_JITTER_PCT / 100;
+	int jitter = jitter_max ? rand() % (2 * jitter_max + 1) - jitter_max : 0;
+	return (unsigned)std::max(1, (int)base + jitter);
+}
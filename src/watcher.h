@@ -0,0 +1,44 @@
+#ifndef COH_WATCHER_H
+#define COH_WATCHER_H
+
+/*
+ * watcher.h
+ * - Headless --watch mode. Keeps today's and tomorrow's timetable
+ *   fresh by polling on a schedule that follows the school day.
+ * - Runs the user's watch_hook command (with the changes on stdin)
+ *   whenever a poll finds a real change.
+ */
+
+class application;
+struct tt_change;
+
+class watcher
+{
+public:
+	watcher(application* const, const std::string&);
+
+	// Poll until interrupted. Returns the exit code.
+	int run(void);
+
+private:
+	// The application we fetch through.
+	application* app;
+
+	// Command to run on changes. Empty for none.
+	std::string hook;
+
+	// Consecutive failed polls, for backing off.
+	unsigned failures;
+
+private:
+	// Fetch today and tomorrow once. Returns false on any error.
+	bool poll(std::vector<tt_change>&);
+
+	// Run the hook with the changes.
+	void run_hook(const std::vector<tt_change>&);
+
+	// How long to sleep until the next poll.
+	unsigned next_interval(void) const;
+};
+
+#endif
@@ -9,7 +9,6 @@
 #include "vec2.h"
 #include "vec4.h"
 #include "window.h"
-#include "wnd_manager.h"
 #include "wnd_string.h"
 
 // Check if anchor Z is type W.
@@ -17,7 +16,8 @@
 
 // Constructor.
 window::window(const vec2& s, const vec2& p, anchor a, const vec4& pad)
-	: size(s), size_real({ 0 }), pos(p), padding(pad), anch(a)
+	: size(s), size_real({ 0 }), pos(p), padding(pad), anch(a),
+	dirty(true), damage_top(0), damage_bot(INT_MAX)
 {
 	// Temporary dimensions and positions.
 	size_real = calc_real_size();
@@ -48,23 +48,24 @@ int window::add_str(const std::string& s, const vec2& p, anchor a, int att)
 void window::chg_str(int idx, const std::string& to, int att)
 {
 	// Don't do anything if we already have this content.
-	if (components[idx].content.compare(to) == 0
-		&& att == -1)
+	wnd_string& c = components[idx];
+	if (c.content.compare(to) == 0 && c.attrib == att)
 	{
 		return;
 	}
 
-	// Change string content
-	components[idx].content = to;
+	// Change string content, and its attributes. (-1 for none.)
+	c.content = to;
+	c.attrib = att;
 
-	// Set attributes if it's not -1.
-	//if (att != -1)
-	//{
-		components[idx].attrib = att;
-	//}
-
-	// Ask for a redraw.
-	invalidate();
+	// Ask for a redraw of just this string, once it has been drawn.
+	if (c.row < 0)
+	{
+		invalidate();
+		return;
+	}
+	c.dirty = true;
+	dirty = true;
 }
 
 // Called when window gets resized.
@@ -85,10 +86,43 @@ void window::on_resize(void)
 // we need.
 void window::redraw_begin(int* w, int* h)
 {
-	// Clear window
-	wclear(wnd);
+	// Changed strings are redrawn with everything else, so their
+	// rows need erasing too.
+	for (unsigned i = 0; i < components.size(); ++i)
+	{
+		if (components[i].dirty)
+		{
+			damage(components[i].row);
+		}
+	}
+
+	// Erase the damaged rows. (wclear would have the whole terminal
+	// cleared and repainted on the next update.) Everything still gets
+	// drawn again, but ncurses only sends the cells that changed.
+	int rows = getmaxy(wnd);
+	int top = std::max(damage_top, 0);
+	int bot = std::min(damage_bot, rows);
+	if (top == 0 && bot == rows)
+	{
+		werase(wnd);
+	}
+	else
+	{
+		for (int y = top; y < bot; ++y)
+		{
+			wmove(wnd, y, 0);
+			wclrtoeol(wnd);
+		}
+	}
+	damage_top = INT_MAX;
+	damage_bot = 0;
 
-	// Get width/height.
+	redraw_size(w, h);
+}
+
+// Get width/height.
+void window::redraw_size(int* w, int* h) const
+{
 	*h = (size.y == COH_WND_STRETCH) ? LINES : std::min(size.y, LINES);
 	*w = (size.x == COH_WND_STRETCH) ? COLS  : std::min(size.x, COLS );
 }
@@ -96,74 +130,113 @@ void window::redraw_begin(int* w, int* h)
 // Redraw the main strings in the window.
 void window::redraw_main(int w, int h)
 {
-	// Iterate over components and draw everything
 	for (unsigned i = 0; i < components.size(); ++i)
 	{
-		wnd_string& c = components[i];
-		size_t tlen = c.content.length();
-
-		// Move the cursor based on anchor and position.
-		int y, x;
+		draw_str(components[i], w, h);
+	}
+}
 
-		// Left-side anchor.
-		// - x simply becomes the relative x pos.
-		if (S_ANCH_IS(c.anch, LEFT))
+// Repaint the strings that changed.
+void window::redraw_strings(int w, int h)
+{
+	// Blank out where they were. Blanks take the background.
+	for (unsigned i = 0; i < components.size(); ++i)
+	{
+		const wnd_string& c = components[i];
+		if (c.dirty && c.len > 0)
 		{
-			x = c.pos.x;
+			mvwhline(wnd, c.row, c.col, ' ', c.len);
 		}
+	}
 
-		// Right-side anchor.
-		// - x becomes wnd width, minus text length, minus offset.
-		if (S_ANCH_IS(c.anch, RIGHT))
+	// Draw them, and anything else we might have blanked.
+	for (unsigned i = 0; i < components.size(); ++i)
+	{
+		wnd_string& c = components[i];
+		bool hit = c.dirty;
+		for (unsigned j = 0; j < components.size() && !hit; ++j)
 		{
-			x = w - c.pos.x - tlen;
+			const wnd_string& o = components[j];
+			hit = o.dirty && o.row == c.row
+				&& o.col < c.col + c.len && c.col < o.col + o.len;
 		}
-
-		// Top anchor.
-		// - y becomes relative y pos.
-		if (S_ANCH_IS(c.anch, TOP))
+		if (hit)
 		{
-			y = c.pos.y;
+			draw_str(c, w, h);
 		}
+	}
+}
 
-		// Bottom anchor.
-		// - y becomes wnd height, minus offset
-		if (S_ANCH_IS(c.anch, BOTTOM))
-		{
-			y = h - c.pos.y - 1;
-		}
+// Draw a string where its anchor puts it.
+void window::draw_str(wnd_string& c, int w, int h)
+{
+	size_t tlen = c.content.length();
 
-		// Centred-vertical anchor.
-		// - y becomes wnd height / 2 plus y position.
-		if (S_ANCH_IS(c.anch, CENT_V))
-		{
-			y = h / 2 + c.pos.y;
-		}
+	// Move the cursor based on anchor and position.
+	int y, x;
 
-		// Centred-horizontal anchor.
-		// - x becomes wnd width/2 minux textlength/2, plus x pos.
-		if (S_ANCH_IS(c.anch, CENT_H))
-		{
-			x = w / 2 - tlen / 2 + c.pos.x;
-		}
+	// Left-side anchor.
+	// - x simply becomes the relative x pos.
+	if (S_ANCH_IS(c.anch, LEFT))
+	{
+		x = c.pos.x;
+	}
 
-		// Move the cursor to our calculated position.
-		wmove(wnd, y, x);
+	// Right-side anchor.
+	// - x becomes wnd width, minus text length, minus offset.
+	if (S_ANCH_IS(c.anch, RIGHT))
+	{
+		x = w - c.pos.x - tlen;
+	}
 
-		// Enable attributes.
-		if (c.attrib != -1)
-		{
-			wattron(wnd, c.attrib);
-		}
+	// Top anchor.
+	// - y becomes relative y pos.
+	if (S_ANCH_IS(c.anch, TOP))
+	{
+		y = c.pos.y;
+	}
 
-		// Draw the string.
-		waddstr(wnd, c.content.c_str());
+	// Bottom anchor.
+	// - y becomes wnd height, minus offset
+	if (S_ANCH_IS(c.anch, BOTTOM))
+	{
+		y = h - c.pos.y - 1;
+	}
 
-		// Disable attrib.
-		if (c.attrib != -1)
-		{
-			wattroff(wnd, c.attrib);
-		}
+	// Centred-vertical anchor.
+	// - y becomes wnd height / 2 plus y position.
+	if (S_ANCH_IS(c.anch, CENT_V))
+	{
+		y = h / 2 + c.pos.y;
+	}
+
+	// Centred-horizontal anchor.
+	// - x becomes wnd width/2 minux textlength/2, plus x pos.
+	if (S_ANCH_IS(c.anch, CENT_H))
+	{
+		x = w / 2 - tlen / 2 + c.pos.x;
+	}
+
+	// Move the cursor to our calculated position.
+	wmove(wnd, y, x);
+	c.row = y;
+	c.col = x;
+	c.len = (int)tlen;
+	c.dirty = false;
+
+	// Enable attributes.
+	if (c.attrib != -1)
+	{
+		wattron(wnd, c.attrib);
+	}
+
+	// Draw the string.
+	waddstr(wnd, c.content.c_str());
+
+	// Disable attrib.
+	if (c.attrib != -1)
+	{
+		wattroff(wnd, c.attrib);
 	}
 }
 
@@ -177,9 +250,18 @@ void window::redraw(void)
 	}
 	dirty = false;
 
+	// Only strings changed, so only they need repainting.
 	int w, h;
-	redraw_begin(&w, &h);
-	redraw_main(w, h);
+	if (damage_top >= damage_bot)
+	{
+		redraw_size(&w, &h);
+		redraw_strings(w, h);
+	}
+	else
+	{
+		redraw_begin(&w, &h);
+		redraw_main(w, h);
+	}
 	redraw_end();
 }
 
@@ -189,14 +271,19 @@ void window::colour_bg_set(int col)
 	wbkgd(wnd, COLOR_PAIR(col));
 }
 
-// Tell the window manager to redraw.
+// Damage the whole window.
+// The window manager redraws it with the next frame.
 void window::invalidate(void)
 {
-	// Mark dirty.
-	dirty = true;
+	damage(0, INT_MAX);
+}
 
-	// Tell window manager to redraw.
-	wnd_manager::get().redraw();
+// Damage some rows.
+void window::damage(int y, int h)
+{
+	dirty = true;
+	damage_top = std::min(damage_top, y);
+	damage_bot = std::max(damage_bot, h > INT_MAX - y ? INT_MAX : y + h);
 }
 
 // Calculate the real size of the window.
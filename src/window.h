@@ -4,6 +4,13 @@
 /*
  * window.h
  * - Wrapper around ncurses window.
+ * - Drawing is batched. Invalidating only marks rows as damaged. The
+ *   window manager redraws every dirty window once per frame, and each
+ *   one erases just its damaged rows and stages itself with
+ *   wnoutrefresh. A single doupdate then sends the changes.
+ * - Changing a string only marks that string. If nothing else changed,
+ *   the redraw blanks where it was and draws it where it goes, and the
+ *   rest of the window is left alone.
  */
 
 #include "wnd_string.h"
@@ -33,9 +40,12 @@ public:
 	// Colour pair
 	void colour_bg_set(int);
 
-	// Ask for a redraw.
+	// Ask for the whole window to be redrawn.
 	void invalidate(void);
 
+	// Ask for some rows to be redrawn.
+	void damage(int y, int h=1);
+
 	// Get the window pointer.
 	inline WINDOW* const get_wndptr(void) const { return wnd; }
 
@@ -71,12 +81,25 @@ protected:
 	// Do we need a redraw?
 	bool dirty;
 
+	// The damaged rows, from top up to (not including) bottom.
+	int damage_top;
+	int damage_bot;
+
 protected:
 	// Obviously use these in redrawing.
 	// They are here mainly for subclass support. (Main window)
 	void redraw_begin(int*, int*);
 	void redraw_main(int, int);
-	inline void redraw_end(void) { wrefresh(wnd); }
+	inline void redraw_end(void) { wnoutrefresh(wnd); }
+
+	// The size strings are placed in.
+	void redraw_size(int*, int*) const;
+
+	// Repaint only the strings that changed.
+	void redraw_strings(int, int);
+
+	// Draw a string, and remember where.
+	void draw_str(wnd_string&, int, int);
 
 	// May merge these into a single method.
 	vec2 calc_real_size(void) const;
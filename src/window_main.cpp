@@ -14,12 +14,14 @@
 #include "vec2.h"
 #include "window.h"
 #include "window_main.h"
+#include "window_second.h"
 #include "wnd_manager.h"
 #include "wnd_string.h"
 
 // Construct the window.
 window_main::window_main(const vec2& s, const vec2& p, anchor a, const vec4& pad)
-	: window(s, p, a, pad), date_info(0)
+	: window(s, p, a, pad), date_info(0),
+	layout_width(0), layout_lines(0), layout_cols(0), layout_stale(true)
 {
 	// Allocate our date string.
 	date_str = new char[12];
@@ -98,57 +100,65 @@ void window_main::set_date(const datetime_dmy& d)
 	// get redrawn with old info.
 	if (date_info) { delete date_info; }
 	date_info = nullptr;
+	layout_stale = true;
 
 	// We need a redraw. This will not actually draw the schedule yet, just the
 	// title.
 	window::invalidate();
 
-	// Redraw events too.
-	wnd_manager::get().get_wnd(COH_WND_IDX_EVENTS)->invalidate();
+	// Redraw events too, from the top.
+	((window_second*)wnd_manager::get().get_wnd(COH_WND_IDX_EVENTS))->events_changed(true);
 }
 
 // Set the date info, allowing a redraw of the timetable.
 void window_main::set_date_info(const tt_day& t)
 {
+	if (date_info) { delete date_info; }
 	date_info = new tt_day(t);
+	layout_stale = true;
 
 	// We need a redraw.
 	window::invalidate();
 
-	// Tell window manager to redraw events too.
-	wnd_manager::get().get_wnd(COH_WND_IDX_EVENTS)->invalidate();
+	// Tell window manager to redraw events too. (It may be the same
+	// day updated, so stay scrolled where we were.)
+	((window_second*)wnd_manager::get().get_wnd(COH_WND_IDX_EVENTS))->events_changed(false);
 }
 
-// Draw the periods. This will be fun...
-void window_main::redraw_periods(void)
+// Lay out the tiles for the day, at this size.
+void window_main::layout(void)
 {
-	// Return if nothing to draw.
+	tiles.clear();
+	labels.clear();
+	layout_width = get_main_area_width();
+	layout_lines = LINES;
+	layout_cols  = COLS;
+	layout_stale = false;
+
+	// Return if nothing to lay out.
 	if (!date_info) { return; }
 
-	// Variables we might use pretty often.
-	static unsigned i;
-	static unsigned day_begin;
-
 	// How much space we have in the window
 	// with offset taken into account.
 	unsigned height_total = LINES - COH_WND_MAIN_PERIODS_OFFSX - 1;
 
 	// Get the approximate total length of the day.
+	unsigned day_begin;
 	unsigned day_hours = get_day_length(&day_begin);
 
 	// Forced offset of tiles. Is adjusted if a tile was was too small and needed
 	// to be clamped.
 	unsigned y_force_next = 0;
 
-
-	// Draw each of the tiles.
+	// Lay out each of the tiles.
 	// The way they should be laid out is defined at the top of
 	// window_main.h.
 	// Bit of a difficult logic problem to solve...
-	for (i = 0; i < date_info->periods.size(); ++i)
+	tiles.reserve(date_info->periods.size());
+	for (unsigned i = 0; i < date_info->periods.size(); ++i)
 	{
 		// This period reference.
-		tt_period& p = date_info->periods[i];
+		const tt_period& p = date_info->periods[i];
 
 		// New idea: Convert the begin/finish times into "row space".
 		// We ceil the end rows, and floor the beginning.
@@ -169,26 +179,26 @@ void window_main::redraw_periods(void)
 		unsigned y_force = y_force_next;
 		y_force_next += (float)h - h_unclamped;
 
-		// Enable the box colour palette.
-		int state_col = get_state_colours(p.state);
-		wattron(wnd, COLOR_PAIR(state_col));
-
-		// Calculate width.
-		unsigned wid = get_main_area_width();
-
-		// Draw our background box.
-		draw_fancy_box(p_beg_row + y_force, h, wid, state_col);
-
-		// Draw the label.
-		unsigned str_y = COH_WND_MAIN_PERIODS_OFFSY + p_beg_row + 1 + y_force;
-		unsigned str_x = COH_WND_MAIN_PERIODS_OFFSX + 1;
+		tile t;
+		t.y       = p_beg_row + y_force;
+		t.h       = h;
+		t.colour  = get_state_colours(p.state);
+		t.label_y = COH_WND_MAIN_PERIODS_OFFSY + t.y + 1;
+		t.label_begin = labels.size();
+		p.begin.str(t.begin_str);
+
+		// Add a piece of label, on a line of the tile.
+		int str_x = COH_WND_MAIN_PERIODS_OFFSX + 1;
+		auto l_label = [&](int line, int x, attr_t a, std::string s)
+		{
+			labels.push_back({ t.label_y + line, x, a, std::move(s) });
+		};
 
 		// Create the title string.
-		std::string title_str = "";
-		title_str.reserve(32);
+		std::string title_str;
 		if (p.state == period_state::CANCELLED)
 		{
-			title_str += "(Cancel) ";
+			title_str = "(Cancel) ";
 		}
 
 		// If we have parsed the period, we can split the information
@@ -217,17 +227,13 @@ void window_main::redraw_periods(void)
 				str_new_tchr  = p.t_tchr.substr(cdelim_tchr + 1, p.t_tchr.length() - cdelim_tchr);
 			}
 
-			// Make sure cursor is moved to correct pos before calling this.
-			auto l_draw_orig_and_new = [&](const std::string& s_o, const std::string& s_n)
+			// Follows on from the piece before.
+			auto l_orig_and_new = [&](int line, const std::string& s_o, const std::string& s_n)
 			{
 				// Just draw new in standout, and old in dim.
-				wattron (wnd, A_STANDOUT);
-				waddstr (wnd, s_n.c_str());
-				wattroff(wnd, A_STANDOUT);
-				waddch  (wnd, ' ');
-				wattron (wnd, A_DIM);
-				waddstr (wnd, ("(was " + s_o + ")").c_str());
-				wattroff(wnd, A_DIM);
+				l_label(line, -1, A_STANDOUT, s_n);
+				l_label(line, -1, 0,          " ");
+				l_label(line, -1, A_DIM,      "(was " + s_o + ")");
 			};
 
 			// Adjust based on row count.
@@ -235,63 +241,61 @@ void window_main::redraw_periods(void)
 			{
 				// Single row:
 				title_str += ": " + str_new_room + ", " + str_new_tchr;
-				mvwaddstr(wnd, str_y, str_x, title_str.c_str());
+				l_label(0, str_x, 0, std::move(title_str));
 			}
 			else if (h == 4)
 			{
 				// Two rows.
 
-				// Draw the room.
+				// The room.
 				if (!chg_room)
 				{
-					// Not changed.  Just draw normally.
-					title_str += " in " + str_new_room;
-					mvwaddstr(wnd, str_y, str_x, title_str.c_str());
+					// Not changed. Just draw normally.
+					l_label(0, str_x, 0, title_str + " in " + str_new_room);
 				}
 				else
 				{
-					// Draw the main title and room.
-					title_str += " in ";
-					mvwaddstr(wnd, str_y, str_x, title_str.c_str());
-					l_draw_orig_and_new(str_orig_room, str_new_room);
+					// The main title and room.
+					l_label(0, str_x, 0, title_str + " in ");
+					l_orig_and_new(0, str_orig_room, str_new_room);
 				}
 
-				// Draw teacher.
-				mvwaddstr(wnd, str_y + 1, str_x, " + Teacher: ");
+				// Teacher.
+				l_label(1, str_x, 0, " + Teacher: ");
 				if (!chg_tchr)
 				{
-					waddstr(wnd, str_new_tchr.c_str());
+					l_label(1, -1, 0, str_new_tchr);
 				}
 				else
 				{
-					l_draw_orig_and_new(str_orig_tchr, str_new_tchr);
+					l_orig_and_new(1, str_orig_tchr, str_new_tchr);
 				}
 			}
 			else if (h > 4)
 			{
 				// Three rows.
-				mvwaddstr(wnd, str_y, str_x, title_str.c_str());
+				l_label(0, str_x, 0, std::move(title_str));
 
-				// Draw room:
-				mvwaddstr(wnd, str_y + 1, str_x, " + In ");
+				// Room.
+				l_label(1, str_x, 0, " + In ");
 				if (!chg_room)
 				{
-					waddstr(wnd, str_new_room.c_str());
+					l_label(1, -1, 0, str_new_room);
 				}
 				else
 				{
-					l_draw_orig_and_new(str_orig_room, str_new_room);
+					l_orig_and_new(1, str_orig_room, str_new_room);
 				}
 
-				// Draw teacher.
-				mvwaddstr(wnd, str_y + 2, str_x, " + Teacher: ");
+				// Teacher.
+				l_label(2, str_x, 0, " + Teacher: ");
 				if (!chg_tchr)
 				{
-					waddstr(wnd, str_new_tchr.c_str());
+					l_label(2, -1, 0, str_new_tchr);
 				}
 				else
 				{
-					l_draw_orig_and_new(str_orig_tchr, str_new_tchr);
+					l_orig_and_new(2, str_orig_tchr, str_new_tchr);
 				}
 			}
 		}
@@ -299,103 +303,100 @@ void window_main::redraw_periods(void)
 		{
 			// Not parsed. Just use the title Compass gives us.
 			title_str += p.title;
-			mvwaddstr(wnd, str_y, str_x, title_str.c_str());
+			l_label(0, str_x, 0, std::move(title_str));
 		}
 
 		// End time label. Anchored to right of the tile.
-		char end_time_str[16] = "Finish ";
-		char end_time_str_time[6];
-		p.end.str(end_time_str_time);
-		strcat(end_time_str, end_time_str_time);
-		mvwaddstr(wnd, str_y, wid - strlen(end_time_str) - 1, end_time_str);
+		char end_time_str[6];
+		p.end.str(end_time_str);
+		std::string fin = std::string("Finish ") + end_time_str;
+		int fin_x = layout_width - fin.length() - 1;
+		l_label(0, fin_x, 0, std::move(fin));
+
+		t.label_end = labels.size();
+		tiles.push_back(t);
+	}
+}
+
+// Draw the periods, laying them out first if we must.
+void window_main::redraw_periods(void)
+{
+	if (layout_stale || layout_lines != LINES || layout_cols != COLS)
+	{
+		layout();
+	}
+
+	for (const tile& t : tiles)
+	{
+		// Enable the box colour palette.
+		wattron(wnd, COLOR_PAIR(t.colour));
+
+		// Draw our background box, and the labels on it.
+		draw_fancy_box(t.y, t.h, layout_width, t.colour);
+		for (unsigned i = t.label_begin; i < t.label_end; ++i)
+		{
+			const tile_label& l = labels[i];
+			if (l.x >= 0)
+			{
+				wmove(wnd, l.y, l.x);
+			}
+			if (l.attrib) { wattron(wnd, l.attrib); }
+			waddstr(wnd, l.text.c_str());
+			if (l.attrib) { wattroff(wnd, l.attrib); }
+		}
 
 		// Disable box colour palette
-		wattroff(wnd, COLOR_PAIR(state_col));
+		wattroff(wnd, COLOR_PAIR(t.colour));
 
 		// Draw the start time label. XX:XX (6 chars w/ NT char)
 		// TODO: 12-hour time preference for normal people.
-		char beg_time_str[6];
-		p.begin.str(beg_time_str);
-		mvwaddstr(wnd, str_y, str_x - 7, beg_time_str);
-    }
+		mvwaddstr(wnd, t.label_y, COH_WND_MAIN_PERIODS_OFFSX + 1 - 7, t.begin_str);
+	}
 }
 
 // Draw a fancy box. Width is same as window.
 // NOTE: we cannot have a stretched X width!
+// Whole rows and columns at a time, so a tile costs a few calls per
+// row rather than one per cell.
 void window_main::draw_fancy_box(unsigned ypos, unsigned h, unsigned w, int state_col)
 {
-	char rcprops;
-	chtype c;
-
-	// Draw the box.
-	for (unsigned y = 0; y < h; ++y)
+	const int x0 = COH_WND_MAIN_PERIODS_OFFSX;
+	const int x1 = (int)w - 1;
+	if (x1 <= x0 || h < 2)
 	{
-		for (unsigned x = COH_WND_MAIN_PERIODS_OFFSX; x < w; ++x)
-		{
-			// The char we want to print.
-			c = ' ' | A_INVIS;
-
-			// Bunch of state booleans packed into single char.
-			rcprops =
-				  (y == 0)
-				| ((y == h - 1) << 1)
-				| ((x == COH_WND_MAIN_PERIODS_OFFSX) << 2)
-				| ((x == w - 1) << 3);
-
-			// Macros to access row properties.
-		#define row_top (rcprops & 1)
-		#define row_bot (rcprops & (1 << 1))
-		#define col_lft (rcprops & (1 << 2))
-		#define col_rgt (rcprops & (1 << 3))
-
-			// Get line graphic chars.
-			if (row_top || row_bot)
-			{
-				if (col_lft)
-				{
-					// Upper/lower-left corners.
-					if (row_top) { c = ACS_ULCORNER; }
-					if (row_bot) { c = ACS_LLCORNER; }
-				}
-				else if (col_rgt)
-				{
-					// Upper/lower-right corners.
-					if (row_top) { c = ACS_URCORNER; }
-					if (row_bot) { c = ACS_LRCORNER; }
-
-					// Blacken foreground.
-					c |= COLOR_PAIR(state_col + COH_COL_PERIOD_FG_STRIDE);
-				}
-				else
-				{
-					// Draw horizontal line on first and last rows that aren't corners.
-					c = ACS_HLINE;
-					if (row_bot)
-					{
-						c |= COLOR_PAIR(state_col + COH_COL_PERIOD_FG_STRIDE);
-					}
-				}
-			}
-			else if (col_lft)
-			{
-				// Draw vertical line on first column.
-				c = ACS_VLINE;
-			}
-			else if (col_rgt)
-			{
-				// Draw vertical line on last column.
-				c = ACS_VLINE | COLOR_PAIR(state_col + COH_COL_PERIOD_FG_STRIDE);
-			}
+		return;
+	}
+	const int y0 = COH_WND_MAIN_PERIODS_OFFSY + ypos;
+	const int y1 = y0 + h - 1;
+	const int inner = x1 - x0 - 1;
+
+	// The box's colour, and the darker one for its right and bottom edges.
+	// Given on each char, as the line functions ignore wattron.
+	const chtype col = COLOR_PAIR(state_col);
+	const chtype dark = COLOR_PAIR(state_col + COH_COL_PERIOD_FG_STRIDE);
+
+	// Just invisible chars with background inside. A blank looks the
+	// same without A_INVIS, and then the labels don't have to turn it
+	// off and on again around them.
+	const chtype fill = ' ' | col | (wnd_manager::get().is_low_bandwidth() ? 0 : A_INVIS);
+	for (int y = y0 + 1; y < y1; ++y)
+	{
+		mvwhline(wnd, y, x0 + 1, fill, inner);
+	}
 
-			// Just draw invisible chars with background..
-			mvwaddch(wnd, COH_WND_MAIN_PERIODS_OFFSY + y + ypos, x, c);
+	// Top and bottom edges.
+	mvwaddch(wnd, y0, x0, ACS_ULCORNER | col);
+	mvwhline(wnd, y0, x0 + 1, ACS_HLINE | col, inner);
+	mvwaddch(wnd, y0, x1, ACS_URCORNER | dark);
+	mvwaddch(wnd, y1, x0, ACS_LLCORNER | col);
+	mvwhline(wnd, y1, x0 + 1, ACS_HLINE | dark, inner);
+	mvwaddch(wnd, y1, x1, ACS_LRCORNER | dark);
 
-			// Undefine these macros
-		#undef row_top
-		#undef row_bot
-		#undef col_lft
-		#undef col_rgt
-		}
+	// Left and right edges.
+	if (h > 2)
+	{
+		mvwvline(wnd, y0 + 1, x0, ACS_VLINE | col, h - 2);
+		mvwvline(wnd, y0 + 1, x1, ACS_VLINE | dark, h - 2);
 	}
 }
 
@@ -14,6 +14,9 @@
  * - Colour change based on state of period.
  * - Most periods should be sitting on top of each other.
  *   They should not if they start/finish at different times.
+ *
+ * The tiles are laid out once per day and terminal size, into rects
+ * and ready-made labels, so a redraw only has to copy them out.
  */
 
 #include "vec4.h"
@@ -49,10 +52,37 @@ public:
 	}
 
 private:
+	// A piece of a tile's label. Pieces with x of -1 carry on
+	// from the end of the one before.
+	struct tile_label
+	{
+		int y, x;
+		attr_t attrib;
+		std::string text;
+	};
+
+	// A period's tile, and its labels in 'labels'.
+	struct tile
+	{
+		unsigned y, h;   // Rows, down from the top of the periods.
+		int colour;      // Its state's colour pair.
+		unsigned label_begin, label_end;
+		int label_y;     // Row of its first line of label.
+		char begin_str[6];
+	};
+
 	char* date_str;
 	tt_day* date_info;
 
+	// The laid out tiles, and what they were laid out for.
+	std::vector<tile> tiles;
+	std::vector<tile_label> labels;
+	unsigned layout_width;
+	int layout_lines, layout_cols;
+	bool layout_stale;
+
 private:
+	void layout(void);
 	void redraw_periods(void);
 	void draw_fancy_box(unsigned, unsigned, unsigned, int);
 	unsigned get_day_length(unsigned*) const;
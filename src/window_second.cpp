@@ -20,7 +20,7 @@
 
 // Construct window.
 window_second::window_second(const vec2& s, const vec2& p, anchor a, const vec4& pad)
-	: window(s, p, a, pad)
+	: window(s, p, a, pad), wrapped_width(-1), top(0)
 {
     // Same as on_resize, but don't invalidate just yet.
 	size_real = calc_real_size();
@@ -74,7 +74,7 @@ void window_second::redraw(void)
 		redraw_main(w, h);
 
 		// Draw the events list.
-		redraw_events(events);
+		redraw_events(events, w);
 	}
 	else
 	{
@@ -101,27 +101,53 @@ void window_second::on_resize(void)
 }
 
 
-// Redraw the events.
-void window_second::redraw_events(const std::vector<tt_period>& events)
+// The events changed.
+void window_second::events_changed(bool to_top)
 {
-	// Move to the start point for text.
-	wmove(wnd, COH_WND_MAIN_TITLE_OFFSY + 2, 0);
+	lines.clear();
+	wrapped_width = -1;
+	if (to_top)
+	{
+		top = 0;
+	}
+	invalidate();
+}
+
+// Scroll the list. Only the list's rows need redrawing.
+void window_second::scroll_by(int n)
+{
+	int rows = list_rows();
+	int top_max = std::max((int)lines.size() - rows, 0);
+	int t = std::min(std::max(top + n, 0), top_max);
+	if (t == top)
+	{
+		return;
+	}
+	top = t;
+	damage(COH_WND_EVENTS_OFFSY, rows);
+}
 
-	// Iterate over all the events.
+// Wrap the events to a width. The bullet takes two columns on the
+// left, and the scroll arrows one on the right.
+void window_second::wrap_events(const std::vector<tt_period>& events, int w)
+{
+	lines.clear();
+	wrapped_width = w;
+	unsigned text_w = (unsigned)std::max(w - 3, 1);
+
+	std::vector<std::string> wrapped;
 	for (unsigned i = 0; i < events.size(); ++i)
 	{
 		// This event
 		const tt_period& e = events[i];
+		if (i)
+		{
+			lines.push_back({ false, "" });
+		}
 
-		// Draw the bullet.
-		waddch(wnd, ACS_BULLET);
-		waddch(wnd, ' ');
-
-		// Draw the title with time.
-		std::string title;
-		title.reserve(26);
-
+		// The title with time.
 		// Don't show the time if they are "placeholder" times. (00:00 to 01:00)
+		std::string title;
 		if (!(e.begin.hour == 0 && e.end.hour == 1))
 		{
 			char time_str[16];
@@ -129,15 +155,58 @@ void window_second::redraw_events(const std::vector<tt_period>& events)
 			title += time_str;
 		}
 		title += e.title;
-		waddstr(wnd, title.c_str());
 
-		// Move cursor down a line, and to the beginning.
-		int curs_y, curs_x;
-		getyx(wnd, curs_y, curs_x);
-		wmove(wnd, curs_y + 2, 0);
+		wrapped.clear();
+		util::wrap(wrapped, title, text_w);
+		for (unsigned j = 0; j < wrapped.size(); ++j)
+		{
+			lines.push_back({ j == 0, std::move(wrapped[j]) });
+		}
 	}
 }
 
+// Redraw the lines of the events that fit.
+void window_second::redraw_events(const std::vector<tt_period>& events, int w)
+{
+	if (wrapped_width != w)
+	{
+		wrap_events(events, w);
+	}
+
+	// Stay in range. (We may have been made taller, or the day
+	// may have fewer events than it did.)
+	int rows = list_rows();
+	top = std::min(top, std::max((int)lines.size() - rows, 0));
+
+	int end = std::min((int)lines.size(), top + rows);
+	for (int i = top; i < end; ++i)
+	{
+		int y = COH_WND_EVENTS_OFFSY + i - top;
+		if (lines[i].first)
+		{
+			mvwaddch(wnd, y, 0, ACS_BULLET);
+			waddch(wnd, ' ');
+		}
+		mvwaddstr(wnd, y, 2, lines[i].text.c_str());
+	}
+
+	// Show there's more above or below.
+	if (top > 0)
+	{
+		mvwaddch(wnd, COH_WND_EVENTS_OFFSY, w - 1, ACS_UARROW);
+	}
+	if (end < (int)lines.size())
+	{
+		mvwaddch(wnd, COH_WND_EVENTS_OFFSY + rows - 1, w - 1, ACS_DARROW);
+	}
+}
+
+// Number of rows the list has.
+int window_second::list_rows(void) const
+{
+	return std::max(getmaxy(wnd) - COH_WND_EVENTS_OFFSY, 0);
+}
+
 // Get the date info structure from the main window. No point having it in memory twice here.
 tt_day* const window_second::get_date_info(void) const
 {
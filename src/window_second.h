@@ -8,6 +8,8 @@
  * just look confusing as hell.
  *
  * We simply draw events a "bulleted" list.
+ * - Titles are word wrapped once per day and width, and only the
+ *   lines that fit are drawn. The rest can be scrolled to.
  */
 
 #include "vec4.h"
@@ -29,12 +31,36 @@ public:
 	// On resize.
 	void on_resize(void) override;
 
+	// The events changed. Optionally scroll back to the top,
+	// for a different day.
+	void events_changed(bool);
+
+	// Scroll the list by some lines.
+	void scroll_by(int);
+
 private:
 	vec2 size_orig;
 
+	// One line of the wrapped list. The first line of each
+	// event gets the bullet, and blank lines go between them.
+	struct event_line
+	{
+		bool first;
+		std::string text;
+	};
+	std::vector<event_line> lines;
+
+	// The width the lines were wrapped to. (-1 if they need doing.)
+	int wrapped_width;
+
+	// The first line shown.
+	int top;
+
 private:
 	tt_day* const get_date_info(void) const;
-	void redraw_events(const std::vector<tt_period>&);
+	void wrap_events(const std::vector<tt_period>&, int);
+	void redraw_events(const std::vector<tt_period>&, int);
+	int list_rows(void) const;
 	unsigned get_main_area_width(void) const;
 };
 
@@ -9,17 +9,27 @@
 #include "application.h"
 #include "datetime.h"
 #include "datetime_dmy.h"
+#include "fetch_scheduler.h"
 #include "net_client.h"
+#include "session_manager.h"
+#include "term_meter.h"
 #include "tt_day.h"
 #include "tt_period.h"
+#include "ui_loop.h"
 #include "vec2.h"
 #include "window.h"
 #include "window_main.h"
 #include "window_second.h"
 #include "wnd_manager.h"
 
+// Last progress number shown while loading.
+static std::atomic<unsigned> progress_shown(~0u);
+
 // Constructor.
 wnd_manager::wnd_manager()
+	: loop(new ui_loop()), ui_thread(std::this_thread::get_id()),
+	resize_pending(false), nav_pending(false), fetching(false), sessions(nullptr), relogged(false),
+	low_bandwidth(false), meter(nullptr)
 {
 	// Initialise ncurses TUI.
 	ncurses_init();
@@ -40,6 +50,9 @@ wnd_manager::wnd_manager()
 	window_main* wmain = new window_main({ COH_WND_STRETCH, 100 },  { 2, 0 }, anchor::LEFT, { 1, 0, 2, 0 });
 	wmain_str_load     = wmain->add_str("", { 4, 0 }, ANCH_CTR_T);
 
+	// We only read keys once the loop says there are some.
+	wtimeout(wmain->get_wndptr(), 0);
+
 	// Events
 	window* wevnt    = new window_second({ COH_WND_STRETCH, 70 }, { 0, 2 }, anchor::RIGHT, { 1, 0, 2, 0 });
 	wevnt->add_str("Events:", { 2, 0 }, ANCH_CTR_T);
@@ -62,27 +75,6 @@ wnd_manager::wnd_manager()
 	wnds[COH_WND_IDX_HEADER] = whead;
 	wnds[COH_WND_IDX_EVENTS] = wevnt;
 	wnds[COH_WND_IDX_STATUS] = wstat;
-
-	// Handle window resizes.
-	struct sigaction sigact_resize = {
-		[](int param)
-		{
-			(void)param;
-
-			// Call these to reinitialise terminal.
-			endwin();
-			wrefresh(stdscr);
-			wclear(stdscr);
-			wrefresh(stdscr);
-
-			// Redraw everything if we aren't too small.
-			if (wnd_manager::can_draw())
-			{
-				wnd_manager::get().on_resize();
-			}
-		}
-	};
-	sigaction(SIGWINCH, &sigact_resize, NULL);
 }
 
 // Destructor.
@@ -96,6 +88,35 @@ wnd_manager::~wnd_manager()
 	{
 		delete wnds[i];
 	}
+	delete loop;
+
+	// Now the terminal is back to normal, say what we sent it.
+	if (meter)
+	{
+		meter->report(stdout);
+		delete meter;
+	}
+}
+
+// Go easy on the terminal.
+void wnd_manager::set_low_bandwidth(bool on)
+{
+	low_bandwidth = on;
+	idlok(stdscr, on);
+	for (unsigned i = 0; i < wnds.size(); ++i)
+	{
+		idlok(wnds[i]->get_wndptr(), on);
+	}
+	LOG_INFO("Low bandwidth mode %s.", on ? "on" : "off");
+}
+
+// Start counting terminal output.
+void wnd_manager::meter_start(void)
+{
+	if (!meter)
+	{
+		meter = new term_meter();
+	}
 }
 
 // Called when we have everything already initialised.
@@ -103,6 +124,7 @@ void wnd_manager::redraw_initial(void)
 {
 	// Refresh all our stuff from cache.
 	refresh_from_cache();
+	at_midnight();
 
 	// Make sure we have reasonable size.
     if (wnd_manager::can_draw())
@@ -130,11 +152,12 @@ void wnd_manager::on_resize(void)
 	for (unsigned i = 0; i < wnds.size(); ++i)
 	{
 		wnds[i]->on_resize();
-		wnds[i]->redraw();
 	}
+	redraw();
 }
 
-// Force draw all windows.
+// Draw the invalidated windows.
+// Each stages its changes, and they all go to the terminal at once.
 void wnd_manager::redraw(void)
 {
 	use_default_colors();
@@ -144,64 +167,256 @@ void wnd_manager::redraw(void)
 	{
 		wnds[i]->redraw();
 	}
+	if (meter) { meter->frame_begin(); }
+	doupdate();
+	if (meter) { meter->frame_end(); }
 }
 
 // Update loop, called constantly.
 // Return false when the program terminates.
 bool wnd_manager::update(void)
 {
-	// Handle inputs.
+	// Draw whatever changed since we last slept, as one frame.
+	redraw();
+
+	// Sleep until there's something to do. Timers run in here.
+	unsigned ev = loop->wait();
+
+	// Run anything the workers sent us.
+	if (ev & ui_loop::UI_EV_POSTED)
+	{
+		run_posted();
+	}
+	if (ev & ui_loop::UI_EV_RESIZE)
+	{
+		resize_later();
+	}
+	if (!(ev & ui_loop::UI_EV_INPUT))
+	{
+		return true;
+	}
+
+	// Handle every key that came in. Navigation keys only add up
+	// here, and we move once for all of them.
+	int nav = 0;
 	int ch;
-	switch(ch = wgetch(get_wnd_main()->get_wndptr()))
+	while ((ch = wgetch(get_wnd_main()->get_wndptr())) != ERR)
 	{
-		// 'q' to quit.
-		case ('q'):
-		case ('Q'):
+		if (meter) { meter->key(); }
+		switch(ch)
 		{
-			// Exit program.
-			return false;
+			// 'q' to quit.
+			case ('q'):
+			case ('Q'):
+			{
+				// Exit program.
+				return false;
+			}
+
+			// 'r' to refresh.
+			case ('r'):
+			case ('R'):
+			{
+				refresh_from_server();
+			} break;
+
+			// 'h' to navigate left.
+			case ('h'):
+			case ('H'):
+			{
+				--nav;
+			} break;
+
+			// 'l' to navigate right.
+			case ('l'):
+			case ('L'):
+			{
+				++nav;
+			} break;
+
+			// 'j' and 'k' to scroll the events.
+			case ('j'):
+			case ('J'):
+			{
+				((window_second*)get_wnd(COH_WND_IDX_EVENTS))->scroll_by(1);
+			} break;
+			case ('k'):
+			case ('K'):
+			{
+				((window_second*)get_wnd(COH_WND_IDX_EVENTS))->scroll_by(-1);
+			} break;
 		}
+	}
+	if (nav)
+	{
+		navigate(nav);
+	}
 
-		// 'r' to refresh.
-		case ('r'):
-		case ('R'):
-		{
-			refresh_from_server();
-		} break;
+	return true;
+}
 
-		// 'h' to navigate left.
-		case ('h'):
-		case ('H'):
-		{
-			// Tell the app to decrement date
-			app->cur_date_decr();
+// Move the date. Holding a key sends a burst of these, so the
+// title follows straight away, but the day is only loaded from
+// the cache once we stop on it. (Or straight away, if we aren't
+// in a burst yet.)
+void wnd_manager::navigate(int days)
+{
+	refresh_abandon();
+	datetime_dmy from = app->get_cur_date();
+	app->cur_date_add(days);
 
-			// Refresh from cache.
-			refresh_from_cache();
-		} break;
+	nav_at = std::chrono::steady_clock::now();
+	if (nav_pending)
+	{
+		return;
+	}
+	nav_pending = true;
+	nav_from = from;
+	nav_shown = app->get_cur_date();
+	refresh_from_cache();
+	loop->after(COH_WND_NAV_SETTLE_MS, [this]() { navigate_settled(); });
+}
 
-		// 'l' to navigate right.
-		case ('l'):
-		case ('L'):
-		{
-			// Tell the app to increment date
-			app->cur_date_incr();
+// Load the day we stopped on, if we've stopped, and prefetch the
+// days we went past without looking at.
+void wnd_manager::navigate_settled(void)
+{
+	auto quiet = std::chrono::duration_cast<std::chrono::milliseconds>(
+		std::chrono::steady_clock::now() - nav_at).count();
+	if (quiet < COH_WND_NAV_SETTLE_MS)
+	{
+		loop->after(COH_WND_NAV_SETTLE_MS - quiet, [this]() { navigate_settled(); });
+		return;
+	}
+	nav_pending = false;
 
-			// Refresh from cache.
-			refresh_from_cache();
-		} break;
+	datetime_dmy to = app->get_cur_date();
+	if (!(to == nav_shown))
+	{
+		refresh_from_cache();
 	}
 
-	return true;
+	// The days in between, nearest the one we stopped on first.
+	// The workers skip any we already have fresh.
+	int id_from = datetime_dmy_id(nav_from).id;
+	int id_to   = datetime_dmy_id(to).id;
+	if (id_from == id_to)
+	{
+		return;
+	}
+	int step = id_to > id_from ? -1 : 1;
+	datetime_dmy d = application::date_add(to, step);
+	for (int n = 0; n < COH_WND_NAV_PREFETCH && !(d == nav_from); ++n)
+	{
+		app->fetch(d, FETCH_PREFETCH);
+		d = application::date_add(d, step);
+	}
+}
+
+// Run a function on the UI thread.
+void wnd_manager::run_on_ui_thread(std::function<void(void)> f)
+{
+	if (std::this_thread::get_id() == ui_thread)
+	{
+		f();
+		return;
+	}
+	{
+		std::lock_guard<std::mutex> lk(posted_mtx);
+		posted.emplace_back(std::move(f));
+	}
+	loop->wake();
+}
+
+// Run the posted functions.
+void wnd_manager::run_posted(void)
+{
+	// Swap out so we don't hold the lock while running them.
+	std::vector<std::function<void(void)>> todo;
+	{
+		std::lock_guard<std::mutex> lk(posted_mtx);
+		todo.swap(posted);
+	}
+	for (unsigned i = 0; i < todo.size(); ++i)
+	{
+		todo[i]();
+	}
+}
+
+// The terminal changed size.
+// Resizing by dragging sends a burst of these, so wait for them to stop.
+void wnd_manager::resize_later(void)
+{
+	resized_at = std::chrono::steady_clock::now();
+	if (resize_pending)
+	{
+		return;
+	}
+	resize_pending = true;
+	loop->after(COH_WND_RESIZE_MS, [this]() { resize_settled(); });
+}
+
+// Redraw at the new size, if it has stopped changing.
+void wnd_manager::resize_settled(void)
+{
+	auto quiet = std::chrono::duration_cast<std::chrono::milliseconds>(
+		std::chrono::steady_clock::now() - resized_at).count();
+	if (quiet < COH_WND_RESIZE_MS)
+	{
+		loop->after(COH_WND_RESIZE_MS - quiet, [this]() { resize_settled(); });
+		return;
+	}
+	resize_pending = false;
+
+	// Tell ncurses the new size, and start from a clean screen.
+	// (On a slow link, trust ncurses to know what's on it instead.)
+	struct winsize ws;
+	if (ioctl(STDOUT_FILENO, TIOCGWINSZ, &ws) == 0)
+	{
+		resizeterm(ws.ws_row, ws.ws_col);
+	}
+	if (low_bandwidth)
+	{
+		werase(stdscr);
+		wnoutrefresh(stdscr);
+	}
+	else
+	{
+		wclear(stdscr);
+		wrefresh(stdscr);
+	}
+
+	// Redraw everything if we aren't too small.
+	if (can_draw())
+	{
+		on_resize();
+	}
+}
+
+// Wait for the date to change.
+// "today @" becomes "yesterday @", and the day may have gone stale.
+void wnd_manager::at_midnight(void)
+{
+	std::time_t now = std::time(0);
+	std::tm t;
+	localtime_r(&now, &t);
+	unsigned long secs = 24 * 60 * 60 - (t.tm_hour * 60 * 60 + t.tm_min * 60 + t.tm_sec);
+	loop->after((secs + 1) * 1000, [this]()
+	{
+		refresh_from_cache();
+		at_midnight();
+	});
 }
 
 // Initialises ncurses.
 void wnd_manager::ncurses_init(void)
 {
+	// The locale first, so ncurses draws multibyte text as the
+	// chars it is, the same widths util::wrap measures.
+	setlocale(LC_ALL, "");
 	initscr(); // Initialise screen.
 	cbreak();  // Input one char at a time.
 	noecho();  // Don't echo our inputs.
-	setlocale(LC_ALL, "");
 
 	// Hide the cursor.
 	curs_set(COH_WND_CURSOR_HIDDEN);
@@ -249,7 +464,8 @@ void wnd_manager::show_setup_prompt(void)
 	window swnd = window({ COH_WND_STRETCH, COH_WND_STRETCH }, { 0, 0 });
 	swnd.add_str("Not set up yet. Please create the compasshub.prefs file.", { 0, 0 }, ANCH_CTR);
 	swnd.add_str("Press any key to exit...", { 1, 0 }, ANCH_CTR);
-	swnd.invalidate();
+	swnd.redraw();
+	doupdate();
 
 	// Wait for a keypress.
 	wgetch(swnd.get_wndptr());
@@ -287,9 +503,56 @@ void wnd_manager::cb_login_status_changed(int status)
 		} break;
 	}
 
-	// Apply to window.
+	// Apply to window. (Might be called from a revalidation worker.)
+	wnd_manager& wm = wnd_manager::get();
+	wm.run_on_ui_thread([&wm, s, a]()
+	{
+		wm.get_wnd(COH_WND_IDX_FOOTER)->chg_str(wm.get_wfoot_str_status(), s, a);
+	});
+}
+
+// Called from a fetch worker when a fetch finishes.
+void wnd_manager::cb_day_fetched(const fetch_result& r)
+{
+	wnd_manager& wm = wnd_manager::get();
+	wm.run_on_ui_thread([&wm, r]()
+	{
+		if (r.cls == FETCH_INTERACTIVE)
+		{
+			wm.on_refreshed(r);
+		}
+		// Background fetches only matter if the content changed,
+		// and we're still looking at that day.
+		else if (r.ok && r.changed && wm.app->get_cur_date() == r.date)
+		{
+			LOG_INFO("Day changed in the background. Updating view.");
+			wm.view_date(r.day);
+		}
+	});
+}
+
+// Called from a fetch worker as an interactive fetch receives data.
+// Only posts to the UI when the number shown would change.
+void wnd_manager::cb_fetch_progress(uint64_t got, uint64_t total)
+{
+	unsigned n = total ? (unsigned)(got * 100 / total) : (unsigned)(got / 1024);
+	if (progress_shown.exchange(n) == n)
+	{
+		return;
+	}
+
+	char buf[48];
+	sprintf(buf, total ? COH_SZ_LOADING " %u%%" : COH_SZ_LOADING " %u KB", n);
+	std::string str = buf;
+
 	wnd_manager& wm = wnd_manager::get();
-	wm.get_wnd(COH_WND_IDX_FOOTER)->chg_str(wm.get_wfoot_str_status(), s, a);
+	wm.run_on_ui_thread([&wm, str]()
+	{
+		if (wm.fetching)
+		{
+			wm.get_wnd_main()->chg_str(wm.get_wmain_str_load(), str);
+		}
+	});
 }
 
 // Called whenever the date is set.
@@ -308,20 +571,32 @@ void wnd_manager::cb_date_set(const datetime_dmy& d)
 void wnd_manager::view_date(const tt_day& t)
 {
 	// Change status bar retrieve string.
-	get_wnd(COH_WND_IDX_FOOTER)->chg_str(get_wfoot_str_retrv(), std::string(COH_SZ_RETR_LAST).append(t.retrieved.get_pretty_string()));
+	view_date_retrieved(t);
 
 	// Tell the main window to show our date.
 	get_wnd_main()->set_date_info(t);
 }
 
+// Only update the "Retrieved ..." string for a date.
+void wnd_manager::view_date_retrieved(const tt_day& t)
+{
+	get_wnd(COH_WND_IDX_FOOTER)->chg_str(get_wfoot_str_retrv(), std::string(COH_SZ_RETR_LAST).append(t.retrieved.get_pretty_string()));
+}
+
 // Refresh the date from cache.
 void wnd_manager::refresh_from_cache(void)
 {
 	// Get if we already cached data.
+	// Always show the cached copy straight away, and refresh it
+	// in the background if it's gone stale.
 	tt_day o;
 	if (app->get_tt_for_day_if_cached(o, app->get_cur_date()))
 	{
 		view_date(o);
+		if (app->is_stale(o, app->get_cur_date()))
+		{
+			app->revalidate(app->get_cur_date());
+		}
 	}
 	else
 	{
@@ -330,36 +605,102 @@ void wnd_manager::refresh_from_cache(void)
 	}
 }
 
-// Refresh from the data on server.
+// Refresh from the data on server. This happens in the
+// background, and on_refreshed picks up the result.
 void wnd_manager::refresh_from_server(void)
 {
 	// Set loading string.
 	get_wnd_main()->chg_str(get_wmain_str_load(), COH_SZ_LOADING);
+	fetching = true;
+	progress_shown = ~0u;
 
-	// Tell the app to get the data.
-	// Then we view it here.
-	auto l_get_tt = [&]()
+	app->fetch(app->get_cur_date(), FETCH_INTERACTIVE, &wnd_manager::cb_fetch_progress);
+}
+
+// The user navigated away. Stop the refresh if there is one.
+void wnd_manager::refresh_abandon(void)
+{
+	if (!fetching)
 	{
-		tt_day o;
-		if (app->get_tt_for_day_update(o, app->get_cur_date()))
-		{
-			// Hide the loading string.
-			get_wnd_main()->chg_str(get_wmain_str_load(), "");
+		return;
+	}
+	LOG_INFO("Refresh abandoned.");
+	app->fetch_cancel(FETCH_INTERACTIVE);
+	fetching = false;
+	get_wnd_main()->chg_str(get_wmain_str_load(), "");
+}
+
+// An interactive fetch finished.
+void wnd_manager::on_refreshed(const fetch_result& r)
+{
+	// We may have navigated away and back in the meantime.
+	if (!fetching || !(app->get_cur_date() == r.date))
+	{
+		return;
+	}
+	fetching = false;
 
-			// View the timetable.
-			view_date(o);
+	// Hide the loading string.
+	get_wnd_main()->chg_str(get_wmain_str_load(), "");
 
-			// Done.
-			return true;
+	if (r.ok)
+	{
+		// View the timetable. If it's the same as what we're
+		// showing, only the retrieval time needs to change.
+		if (r.changed || !get_wnd_main()->get_date_info())
+		{
+			view_date(r.day);
 		}
-		return false;
-	};
+		else
+		{
+			view_date_retrieved(r.day);
+		}
+		relogged = false;
+		return;
+	}
 
-	// If we get it, just return.
-	if (l_get_tt()) { return; }
+	// Couldn't get it. Log in from the credential helper if we
+	// can, and only ask the user if that doesn't work. The login
+	// happens on the session thread, so we carry on meanwhile.
+	if (sessions && sessions->has_helper() && !relogged)
+	{
+		get_wnd(COH_WND_IDX_STATUS)->chg_str(wstat_str_status, "Logging in...");
+		datetime_dmy d = r.date;
+		sessions->relogin_later([this, d](bool ok)
+		{
+			run_on_ui_thread([this, d, ok]() { on_relogged(d, ok); });
+		});
+		return;
+	}
+	relogged = false;
+	login_prompt();
+}
 
-	// Hide loading string.
-	get_wnd_main()->chg_str(get_wmain_str_load(), "");
+// The credential helper's login finished.
+void wnd_manager::on_relogged(const datetime_dmy& d, bool ok)
+{
+	get_wnd(COH_WND_IDX_STATUS)->chg_str(wstat_str_status, "");
+
+	// We may have navigated away in the meantime. Whatever asks
+	// for a refresh next will find out how it went.
+	relogged = ok;
+	if (!(app->get_cur_date() == d))
+	{
+		return;
+	}
+	if (ok)
+	{
+		refresh_from_server();
+		return;
+	}
+	relogged = false;
+	login_prompt();
+}
+
+// Ask the user to log in, and refresh if they did.
+void wnd_manager::login_prompt(void)
+{
+	window* const w = get_wnd(COH_WND_IDX_STATUS);
 
 	// Ask for user's credentials.
 	char cred_user[11];
@@ -370,16 +711,14 @@ void wnd_manager::refresh_from_server(void)
 	}
 
 	// Update string.
-	window* const w = get_wnd(COH_WND_IDX_STATUS);
 	w->chg_str(wstat_str_status, "Logging in...");
+	redraw();
 
 	// Try login with what we got.
-	app->client_get()->login(cred_user, cred_pass);
-
-	// Try get schedule.
 	std::string strlogin_status;
 	int strcolour;
-	if (l_get_tt())
+	bool logged_in = app->client_get()->login(cred_user, cred_pass);
+	if (logged_in)
 	{
 		strlogin_status = "Successful login.";
 		strcolour = COH_COL_STATUS_LI;
@@ -390,10 +729,17 @@ void wnd_manager::refresh_from_server(void)
 		strcolour = COH_COL_STATUS_LO;
 	}
 	w->chg_str(wstat_str_status, strlogin_status, COLOR_PAIR(strcolour));
+	redraw();
 
 	// Wait for input to hide string.
 	wgetch(w->get_wndptr());
 	w->chg_str(wstat_str_status, "");
+
+	// Now try get the schedule again.
+	if (logged_in)
+	{
+		refresh_from_server();
+	}
 }
 
 // Ask for user's credentials.
@@ -481,7 +827,7 @@ bool wnd_manager::get_credentials(char* user, char* pass)
 
 	// Write password, string, then get user input.
 	wmove(cwptr, 0, 0);
-	wclear(cwptr);
+	werase(cwptr);
 	wrefresh(cwptr);
 	waddstr(cwptr, "Password: ");
 	l_get_str(pass, true, 63, sizeof("Password: "));
@@ -494,7 +840,7 @@ bool wnd_manager::get_credentials(char* user, char* pass)
 
 cred_end:
 	// Clear the window.
-	wclear(cwptr);
+	werase(cwptr);
 	wrefresh(cwptr);
 
 	curs_set(COH_WND_CURSOR_HIDDEN);
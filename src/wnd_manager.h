@@ -24,9 +24,13 @@
 #define COH_WND_MIN_HEIGHT 15
 
 class application;
+class session_manager;
+class term_meter;
+class ui_loop;
 class window;
 class window_main;
 struct datetime_dmy;
+struct fetch_result;
 struct tt_day;
 
 class wnd_manager
@@ -39,7 +43,7 @@ public:
 		return inst;
 	}
 
-	// Update loop.
+	// Update loop. Sleeps until there's something to do.
 	bool update(void);
 
 	// Force redraw everything
@@ -53,6 +57,11 @@ public:
 
 	// View a date.
 	void view_date(const tt_day&);
+	void view_date_retrieved(const tt_day&);
+
+	// Run a function on the UI thread. Runs straight away if we are
+	// already on it, otherwise it's queued and the UI thread woken.
+	void run_on_ui_thread(std::function<void(void)>);
 
 	// Set the application pointer.
 	inline void set_app(application* const a)
@@ -60,6 +69,24 @@ public:
 		app = a;
 	}
 
+	// Set the session manager, if there is one.
+	inline void set_sessions(session_manager* const s)
+	{
+		sessions = s;
+	}
+
+	// Keep terminal output down, for slow links. Lets ncurses scroll
+	// lines that moved rather than rewrite them, doesn't clear the
+	// screen on resize, and leaves out attributes you can't see.
+	void set_low_bandwidth(bool);
+	inline bool is_low_bandwidth(void) const
+	{
+		return low_bandwidth;
+	}
+
+	// Count terminal output, and print a summary when we exit.
+	void meter_start(void);
+
 	// Show the prompt to set up the program.
 	void show_setup_prompt(void);
 
@@ -91,6 +118,8 @@ public:
 	// Our callbacks
 	static void cb_login_status_changed(int);
 	static void cb_date_set(const datetime_dmy&);
+	static void cb_day_fetched(const fetch_result&);
+	static void cb_fetch_progress(uint64_t, uint64_t);
 
 private:
 	// Our ncurses windows, and their indices.
@@ -106,6 +135,40 @@ private:
 	// The application pointer which we can refer to.
 	application* app;
 
+	// What update() waits on.
+	ui_loop* loop;
+
+	// Work posted from other threads, run in update().
+	std::vector<std::function<void(void)>> posted;
+	std::mutex posted_mtx;
+	std::thread::id ui_thread;
+
+	// When the terminal last changed size, and whether we're
+	// waiting for it to settle.
+	std::chrono::steady_clock::time_point resized_at;
+	bool resize_pending;
+
+	// Where a burst of navigation started, the day it loaded first,
+	// when its last key came in, and whether we're waiting for it
+	// to stop.
+	datetime_dmy nav_from, nav_shown;
+	std::chrono::steady_clock::time_point nav_at;
+	bool nav_pending;
+
+	// Whether we're waiting on an interactive fetch.
+	bool fetching;
+
+	// Keeps the session warm, and logs in from the credential helper.
+	session_manager* sessions;
+
+	// Whether the helper just logged us in, so a refresh that fails
+	// again goes to the prompt rather than round in circles.
+	bool relogged;
+
+	// See set_low_bandwidth and meter_start.
+	bool low_bandwidth;
+	term_meter* meter;
+
 private:
 	wnd_manager();
 	wnd_manager(const wnd_manager&);
@@ -116,9 +179,32 @@ private:
 	void ncurses_init  (void);
 	void ncurses_deinit(void);
 
+	// Run everything posted from other threads.
+	void run_posted(void);
+
+	// The terminal changed size. Redraw once it stops changing.
+	void resize_later(void);
+	void resize_settled(void);
+
+	// Redraw what depends on the date when it changes.
+	void at_midnight(void);
+
 	// Navigation
+	void navigate(int);
+	void navigate_settled(void);
 	void refresh_from_cache(void);
 	void refresh_from_server(void);
+	void refresh_abandon(void);
+
+	// An interactive fetch finished.
+	void on_refreshed(const fetch_result&);
+
+	// The credential helper's login finished, after a refresh of
+	// a day failed.
+	void on_relogged(const datetime_dmy&, bool);
+
+	// Ask the user to log in, and refresh if they did.
+	void login_prompt(void);
 
 	// Misc
 	bool get_credentials(char*, char*);
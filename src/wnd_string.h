@@ -16,8 +16,17 @@ struct wnd_string
 	vec2 pos;
 	int attrib;
 
+	// Where it was last drawn, and how long it was. Row is -1
+	// if it hasn't been drawn.
+	int row;
+	int col;
+	int len;
+
+	// Changed since it was drawn.
+	bool dirty;
+
 	wnd_string(const std::string& c, anchor anch, const vec2& p, int at) 
-		: content(c), anch(anch), pos(p), attrib(at)  {}
+		: content(c), anch(anch), pos(p), attrib(at), row(-1), col(0), len(0), dirty(false)  {}
 };
 
 #endif